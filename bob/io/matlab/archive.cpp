@@ -0,0 +1,483 @@
+/**
+ * @date Fri 16 Oct 16:17:19 2026 UTC
+ *
+ * @brief Python mapping over the variables of a matlab file, which is kept
+ * open and decodes each variable on demand
+ */
+
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <bob.blitz/capi.h>
+#include <bob.blitz/cleanup.h>
+#include <bob.io.base/api.h>
+
+#include "main.h"
+#include "gil.h"
+
+PyDoc_STRVAR(s_mat_archive_str, BOB_EXT_MODULE_PREFIX ".MatArchive");
+
+PyDoc_STRVAR(s_mat_archive_doc,
+"MatArchive(path) -> new archive\n\
+\n\
+Opens a Matlab(R) file for reading, as a mapping from variable names to\n\
+their contents.\n\
+\n\
+The file is opened once and the headers of all variables are read on\n\
+construction. ``archive[varname]`` then decodes that variable only, from\n\
+the position recorded on its header, without searching through the file\n\
+again. Numeric and logical arrays are returned as numpy arrays, char\n\
+arrays as strings (see :py:func:`read_matrix`), sparse matrices as with\n\
+:py:func:`read_sparse`, structs as with :py:func:`read_struct` and cell\n\
+arrays as :py:class:`CellArray` objects.\n\
+\n\
+The file is kept open until :py:meth:`close` is called, or the archive is\n\
+used as a context manager and its block is left. Cell arrays read from\n\
+the archive keep the file open for as long as they exist.\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file to open.\n\
+\n\
+");
+
+static PyObject* PyBobIoMatlabMatArchive_New(PyTypeObject* type, PyObject*, PyObject*) {
+
+  /* Allocates the python object itself */
+  PyBobIoMatlabMatArchiveObject* self = (PyBobIoMatlabMatArchiveObject*)type->tp_alloc(type, 0);
+
+  self->cxx.reset();
+
+  return reinterpret_cast<PyObject*>(self);
+}
+
+static void PyBobIoMatlabMatArchive_Delete (PyBobIoMatlabMatArchiveObject* o) {
+
+  o->cxx.reset();
+  Py_TYPE(o)->tp_free((PyObject*)o);
+
+}
+
+static int PyBobIoMatlabMatArchive_Init(PyBobIoMatlabMatArchiveObject* self, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist,
+        &PyBobIo_FilenameConverter, &filename)) return -1;
+
+  try {
+    gil_release nogil;
+    self->cxx.reset(new mat_archive(filename));
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return -1;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot open matlab file `%s'", filename);
+    return -1;
+  }
+
+  return 0; ///< SUCCESS
+}
+
+/**
+ * Sets the error raised when the archive was closed, and returns 0
+ */
+static PyObject* closed_error (PyBobIoMatlabMatArchiveObject* self) {
+  PyErr_Format(PyExc_ValueError, "I/O operation on closed matlab file `%s'", self->cxx->path().c_str());
+  return 0;
+}
+
+/**
+ * Checks the archive was initialized and is still open, setting an error
+ * otherwise. The archive may still be closed afterwards by another thread,
+ * which then shows as missing headers or file.
+ */
+static bool is_open (PyBobIoMatlabMatArchiveObject* self) {
+  if (!PyBobIoMatlab_CheckInitialized(self)) return false;
+  if (!self->cxx->closed()) return true;
+  closed_error(self);
+  return false;
+}
+
+/**
+ * Returns the name of a variable as a string, or 0 with an error set if it
+ * is not a string
+ */
+static const char* as_name (PyObject* o) {
+# if PY_VERSION_HEX >= 0x03000000
+  if (PyUnicode_Check(o)) return PyUnicode_AsUTF8(o);
+# else
+  if (PyString_Check(o)) return PyString_AsString(o);
+# endif
+  PyErr_SetString(PyExc_TypeError, "variable names should be strings");
+  return 0;
+}
+
+static Py_ssize_t PyBobIoMatlabMatArchive_Len (PyBobIoMatlabMatArchiveObject* self) {
+  if (!is_open(self)) return -1;
+  return self->cxx->names().size();
+}
+
+static int PyBobIoMatlabMatArchive_Contains (PyBobIoMatlabMatArchiveObject* self, PyObject* key) {
+  if (!is_open(self)) return -1;
+  const char* name = as_name(key);
+  if (!name) return -1;
+  return self->cxx->header(name) ? 1 : 0;
+}
+
+/**
+ * Reads a numeric (or logical) array
+ */
+static PyObject* read_numeric (PyBobIoMatlabMatArchiveObject* self,
+    const char* name, boost::shared_ptr<matvar_t> header) {
+
+  mat_type type;
+  mat_peek(header, type);
+  if (type.dtype == bob::io::base::array::t_unknown) {
+    PyErr_Format(PyExc_RuntimeError, "unsupported data type for variable `%s' at matlab file `%s'", name, self->cxx->path().c_str());
+    return 0;
+  }
+
+  if (type.shape.size() > NPY_MAXDIMS) {
+    PyErr_Format(PyExc_RuntimeError, "matlab array has %d dimensions, more than the maximum supported by numpy (%d)", (int)type.shape.size(), NPY_MAXDIMS);
+    return 0;
+  }
+  npy_intp shape[NPY_MAXDIMS];
+  std::copy(type.shape.begin(), type.shape.end(), shape);
+
+  int type_num = PyBobIo_AsTypenum(type.dtype);
+  if (type_num == NPY_NOTYPE) return 0; ///< failure
+
+  PyObject* retval = PyArray_SimpleNew(type.shape.size(), shape, type_num);
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  {
+    void* data = PyArray_DATA((PyArrayObject*)retval);
+    gil_release nogil;
+    self->cxx->read(name, type, data, default_options().threads);
+  }
+
+  return Py_BuildValue("O", retval);
+
+}
+
+static PyObject* PyBobIoMatlabMatArchive_GetItem (PyBobIoMatlabMatArchiveObject* self, PyObject* key) {
+
+  if (!is_open(self)) return 0;
+  const char* name = as_name(key);
+  if (!name) return 0;
+
+  boost::shared_ptr<matvar_t> header = self->cxx->header(name);
+  if (!header) {
+    if (self->cxx->closed()) return closed_error(self);
+    PyErr_SetObject(PyExc_KeyError, key);
+    return 0;
+  }
+
+  try {
+    switch (header->class_type) {
+
+      case MAT_C_CHAR:
+        {
+          std::vector<uint16_t> text;
+          size_t rows, cols;
+          {
+            gil_release nogil;
+            self->cxx->read(name, text, rows, cols, default_options().threads);
+          }
+          return PyBobIoMatlab_TextAsPython(text, rows, cols);
+        }
+
+      case MAT_C_SPARSE:
+        {
+          mat_sparse sparse;
+          {
+            gil_release nogil;
+            self->cxx->read(name, sparse);
+          }
+          return PyBobIoMatlab_SparseAsPython(sparse);
+        }
+
+      case MAT_C_STRUCT:
+        {
+          // the reader shares the file handle, and therefore the mutex
+          boost::shared_ptr<mat_t> file = self->cxx->file();
+          if (!file) return closed_error(self);
+          mat_struct_reader reader(file, header, self->cxx->mutex());
+          return PyBobIoMatlab_StructAsPython(reader, reader.fields());
+        }
+
+      case MAT_C_CELL:
+        {
+          PyBobIoMatlabCellArrayObject* retval = (PyBobIoMatlabCellArrayObject*)
+            PyBobIoMatlabCellArray_Type.tp_alloc(&PyBobIoMatlabCellArray_Type, 0);
+          if (!retval) return 0;
+          auto retval_ = make_safe(retval);
+          boost::shared_ptr<mat_t> file = self->cxx->file();
+          if (!file) return closed_error(self);
+          retval->cxx = boost::make_shared<mat_cell_reader>(file, header,
+              self->cxx->mutex());
+          return Py_BuildValue("O", retval);
+        }
+
+      default:
+        return read_numeric(self, name, header);
+
+    }
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read contents of variable `%s' at matlab file `%s'", name, self->cxx->path().c_str());
+    return 0;
+  }
+
+}
+
+static PyMappingMethods PyBobIoMatlabMatArchive_Mapping = {
+    (lenfunc)PyBobIoMatlabMatArchive_Len,
+    (binaryfunc)PyBobIoMatlabMatArchive_GetItem,
+    0, /* ass_subscript */
+};
+
+static PySequenceMethods PyBobIoMatlabMatArchive_Sequence = {
+    0, /* length */
+    0, /* concat */
+    0, /* repeat */
+    0, /* item */
+    0, /* slice */
+    0, /* ass_item */
+    0, /* ass_slice */
+    (objobjproc)PyBobIoMatlabMatArchive_Contains, /* contains */
+    0, /* inplace_concat */
+    0, /* inplace_repeat */
+};
+
+PyDoc_STRVAR(s_keys_str, "keys");
+PyDoc_STRVAR(s_keys_doc,
+"keys() -> list\n\
+\n\
+The names of the variables in the file, in the order they appear on it\n\
+");
+
+static PyObject* PyBobIoMatlabMatArchive_Keys (PyBobIoMatlabMatArchiveObject* self) {
+
+  if (!is_open(self)) return 0;
+
+  const std::vector<std::string>& names = self->cxx->names();
+  PyObject* retval = PyList_New(names.size());
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  for (size_t k=0; k<names.size(); ++k) {
+    PyObject* name = Py_BuildValue("s", names[k].c_str());
+    if (!name) return 0;
+    PyList_SET_ITEM(retval, k, name);
+  }
+
+  return Py_BuildValue("O", retval);
+
+}
+
+static PyObject* PyBobIoMatlabMatArchive_Iter (PyBobIoMatlabMatArchiveObject* self) {
+  PyObject* keys = PyBobIoMatlabMatArchive_Keys(self);
+  if (!keys) return 0;
+  auto keys_ = make_safe(keys);
+  return PyObject_GetIter(keys);
+}
+
+PyDoc_STRVAR(s_shapes_str, "shapes");
+PyDoc_STRVAR(s_shapes_doc,
+"shapes() -> dict\n\
+\n\
+The shape of each variable, as in Matlab(R), read from the variable\n\
+headers only\n\
+");
+
+static PyObject* PyBobIoMatlabMatArchive_Shapes (PyBobIoMatlabMatArchiveObject* self) {
+
+  if (!is_open(self)) return 0;
+
+  PyObject* retval = PyDict_New();
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  const std::vector<std::string>& names = self->cxx->names();
+  for (size_t k=0; k<names.size(); ++k) {
+    boost::shared_ptr<matvar_t> header = self->cxx->header(names[k]);
+    if (!header) return closed_error(self);
+    PyObject* shape = PyTuple_New(header->rank);
+    if (!shape) return 0;
+    auto shape_ = make_safe(shape);
+    for (int d=0; d<header->rank; ++d) {
+      PyTuple_SET_ITEM(shape, d, Py_BuildValue("n", header->dims[d]));
+    }
+    if (PyDict_SetItemString(retval, names[k].c_str(), shape) < 0) return 0;
+  }
+
+  return Py_BuildValue("O", retval);
+
+}
+
+PyDoc_STRVAR(s_dtypes_str, "dtypes");
+PyDoc_STRVAR(s_dtypes_doc,
+"dtypes() -> dict\n\
+\n\
+The numpy data type of each variable, read from the variable headers\n\
+only. Variables that are not numeric or logical arrays have ``None``.\n\
+");
+
+static PyObject* PyBobIoMatlabMatArchive_DTypes (PyBobIoMatlabMatArchiveObject* self) {
+
+  if (!is_open(self)) return 0;
+
+  PyObject* retval = PyDict_New();
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  const std::vector<std::string>& names = self->cxx->names();
+  for (size_t k=0; k<names.size(); ++k) {
+    boost::shared_ptr<matvar_t> header = self->cxx->header(names[k]);
+    if (!header) return closed_error(self);
+    mat_type type;
+    mat_peek(header, type);
+    PyObject* dtype = 0;
+    if (type.dtype == bob::io::base::array::t_unknown) {
+      Py_INCREF(Py_None);
+      dtype = Py_None;
+    }
+    else {
+      int type_num = PyBobIo_AsTypenum(type.dtype);
+      if (type_num == NPY_NOTYPE) return 0; ///< failure
+      dtype = (PyObject*)PyArray_DescrFromType(type_num);
+      if (!dtype) return 0;
+    }
+    auto dtype_ = make_safe(dtype);
+    if (PyDict_SetItemString(retval, names[k].c_str(), dtype) < 0) return 0;
+  }
+
+  return Py_BuildValue("O", retval);
+
+}
+
+PyDoc_STRVAR(s_close_str, "close");
+PyDoc_STRVAR(s_close_doc,
+"close() -> None\n\
+\n\
+Closes the file. The archive cannot be read any longer. Calling this\n\
+more than once has no effect.\n\
+");
+
+static PyObject* PyBobIoMatlabMatArchive_Close (PyBobIoMatlabMatArchiveObject* self) {
+
+  if (!self->cxx) Py_RETURN_NONE; ///< never opened
+
+  {
+    gil_release nogil;
+    self->cxx->close();
+  }
+
+  Py_RETURN_NONE;
+
+}
+
+static PyObject* PyBobIoMatlabMatArchive_Enter (PyBobIoMatlabMatArchiveObject* self) {
+  if (!is_open(self)) return 0;
+  Py_INCREF(self);
+  return reinterpret_cast<PyObject*>(self);
+}
+
+static PyObject* PyBobIoMatlabMatArchive_Exit (PyBobIoMatlabMatArchiveObject* self, PyObject*) {
+  return PyBobIoMatlabMatArchive_Close(self);
+}
+
+static PyMethodDef PyBobIoMatlabMatArchive_Methods[] = {
+    {
+      s_keys_str,
+      (PyCFunction)PyBobIoMatlabMatArchive_Keys,
+      METH_NOARGS,
+      s_keys_doc,
+    },
+    {
+      s_shapes_str,
+      (PyCFunction)PyBobIoMatlabMatArchive_Shapes,
+      METH_NOARGS,
+      s_shapes_doc,
+    },
+    {
+      s_dtypes_str,
+      (PyCFunction)PyBobIoMatlabMatArchive_DTypes,
+      METH_NOARGS,
+      s_dtypes_doc,
+    },
+    {
+      s_close_str,
+      (PyCFunction)PyBobIoMatlabMatArchive_Close,
+      METH_NOARGS,
+      s_close_doc,
+    },
+    {
+      "__enter__",
+      (PyCFunction)PyBobIoMatlabMatArchive_Enter,
+      METH_NOARGS,
+      0,
+    },
+    {
+      "__exit__",
+      (PyCFunction)PyBobIoMatlabMatArchive_Exit,
+      METH_VARARGS,
+      0,
+    },
+    {0}  /* Sentinel */
+};
+
+PyTypeObject PyBobIoMatlabMatArchive_Type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    s_mat_archive_str,                          /*tp_name*/
+    sizeof(PyBobIoMatlabMatArchiveObject),      /*tp_basicsize*/
+    0,                                          /*tp_itemsize*/
+    (destructor)PyBobIoMatlabMatArchive_Delete, /*tp_dealloc*/
+    0,                                          /*tp_print*/
+    0,                                          /*tp_getattr*/
+    0,                                          /*tp_setattr*/
+    0,                                          /*tp_compare*/
+    0,                                          /*tp_repr*/
+    0,                                          /*tp_as_number*/
+    &PyBobIoMatlabMatArchive_Sequence,          /*tp_as_sequence*/
+    &PyBobIoMatlabMatArchive_Mapping,           /*tp_as_mapping*/
+    0,                                          /*tp_hash */
+    0,                                          /*tp_call*/
+    0,                                          /*tp_str*/
+    0,                                          /*tp_getattro*/
+    0,                                          /*tp_setattro*/
+    0,                                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,                         /*tp_flags*/
+    s_mat_archive_doc,                          /* tp_doc */
+    0,                                        /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    (getiterfunc)PyBobIoMatlabMatArchive_Iter, /* tp_iter */
+    0,                                        /* tp_iternext */
+    PyBobIoMatlabMatArchive_Methods,            /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    (initproc)PyBobIoMatlabMatArchive_Init,     /* tp_init */
+    0,                                          /* tp_alloc */
+    PyBobIoMatlabMatArchive_New,                /* tp_new */
+};
@@ -0,0 +1,201 @@
+/**
+ * @date Fri 16 Oct 15:39:53 2026 UTC
+ *
+ * @brief Python iterator over a matlab variable, by blocks of rows
+ */
+
+#include <bob.blitz/capi.h>
+#include <bob.blitz/cleanup.h>
+#include <bob.io.base/api.h>
+
+#include "main.h"
+#include "gil.h"
+
+PyDoc_STRVAR(s_block_reader_str, BOB_EXT_MODULE_PREFIX ".BlockReader");
+
+PyDoc_STRVAR(s_block_reader_doc,
+"BlockReader(path, varname, rows) -> new iterator\n\
+\n\
+Iterates over a matrix stored in a Matlab(R) file by blocks of rows.\n\
+\n\
+Each iteration returns a new array with (at most) ``rows`` rows of the\n\
+matrix, i.e., a slice along its first dimension. The file is kept open\n\
+while the iterator exists, and many threads may share the iterator.\n\
+\n\
+Uncompressed variables, and variables in version 7.3 files, are decoded\n\
+one block at a time, so this lets you stream through matrices that do\n\
+not fit in memory. matio can only decode compressed variables from their\n\
+start: those of up to 1 GB are decoded once, on the first block, and kept\n\
+in memory until the last one. Larger compressed variables are decoded\n\
+again up to each block, which uses little memory but gets slower as the\n\
+iteration goes on.\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file from which you wish to read the matrix from.\n\
+\n\
+varname, string\n\
+  One of the values returned by :py:func:`read_varnames`\n\
+\n\
+rows, int\n\
+  The number of rows in each block. The last block may be shorter.\n\
+\n\
+");
+
+static PyObject* PyBobIoMatlabBlockReader_New(PyTypeObject* type, PyObject*, PyObject*) {
+
+  /* Allocates the python object itself */
+  PyBobIoMatlabBlockReaderObject* self = (PyBobIoMatlabBlockReaderObject*)type->tp_alloc(type, 0);
+
+  self->cxx.reset();
+
+  return reinterpret_cast<PyObject*>(self);
+}
+
+static void PyBobIoMatlabBlockReader_Delete (PyBobIoMatlabBlockReaderObject* o) {
+
+  o->cxx.reset();
+  Py_TYPE(o)->tp_free((PyObject*)o);
+
+}
+
+static int PyBobIoMatlabBlockReader_Init(PyBobIoMatlabBlockReaderObject* self, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", "varname", "rows", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+  const char* varname;
+  Py_ssize_t rows;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&sn", kwlist,
+        &PyBobIo_FilenameConverter, &filename, &varname, &rows)) return -1;
+
+  if (rows <= 0) {
+    PyErr_Format(PyExc_ValueError, "`%s' needs a positive number of rows per block", Py_TYPE(self)->tp_name);
+    return -1;
+  }
+
+  try {
+    boost::shared_ptr<mat_t> matfile;
+    boost::shared_ptr<matvar_t> header;
+    {
+      gil_release nogil;
+      matfile = make_matfile(filename, MAT_ACC_RDONLY);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+      if (matfile) header = read_header(matfile, varname);
+    }
+
+    if (!matfile) {
+      PyErr_Format(PyExc_RuntimeError,
+          "Could open the matlab file `%s'", filename);
+      return -1;
+    }
+
+    if (!header) {
+      PyErr_Format(PyExc_RuntimeError, "Cannot locate variable `%s' in file '%s'", varname, filename);
+      return -1;
+    }
+    self->cxx.reset(new mat_block_reader(matfile, header, rows,
+          default_options().threads));
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return -1;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read variable `%s' at matlab file `%s' by blocks", varname, filename);
+    return -1;
+  }
+
+  return 0; ///< SUCCESS
+}
+
+static Py_ssize_t PyBobIoMatlabBlockReader_Len (PyBobIoMatlabBlockReaderObject* self) {
+  if (!PyBobIoMatlab_CheckInitialized(self)) return -1;
+  return self->cxx->size();
+}
+
+static PySequenceMethods PyBobIoMatlabBlockReader_Sequence = {
+    (lenfunc)PyBobIoMatlabBlockReader_Len,
+    0, /* concat */
+    0, /* repeat */
+    0, /* item */
+    0, /* slice */
+    0, /* ass_item */
+    0, /* ass_slice */
+    0, /* contains */
+    0, /* inplace_concat */
+    0, /* inplace_repeat */
+};
+
+static PyObject* PyBobIoMatlabBlockReader_Next (PyBobIoMatlabBlockReaderObject* self) {
+
+  if (!PyBobIoMatlab_CheckInitialized(self)) return 0;
+
+  try {
+    // the block is sized and read in one go, as other threads may share us
+    array_buffer buf;
+    bool read;
+    {
+      gil_release nogil;
+      read = self->cxx->read(buf);
+    }
+    if (!read) return 0; ///< StopIteration
+
+    return PyBobIoMatlab_BufferAsPython(buf);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "%s: cannot read next block", Py_TYPE(self)->tp_name);
+    return 0;
+  }
+
+}
+
+PyTypeObject PyBobIoMatlabBlockReader_Type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    s_block_reader_str,                         /*tp_name*/
+    sizeof(PyBobIoMatlabBlockReaderObject),     /*tp_basicsize*/
+    0,                                          /*tp_itemsize*/
+    (destructor)PyBobIoMatlabBlockReader_Delete, /*tp_dealloc*/
+    0,                                          /*tp_print*/
+    0,                                          /*tp_getattr*/
+    0,                                          /*tp_setattr*/
+    0,                                          /*tp_compare*/
+    0,                                          /*tp_repr*/
+    0,                                          /*tp_as_number*/
+    &PyBobIoMatlabBlockReader_Sequence,         /*tp_as_sequence*/
+    0,                                          /*tp_as_mapping*/
+    0,                                          /*tp_hash */
+    0,                                          /*tp_call*/
+    0,                                          /*tp_str*/
+    0,                                          /*tp_getattro*/
+    0,                                          /*tp_setattro*/
+    0,                                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,                         /*tp_flags*/
+    s_block_reader_doc,                         /* tp_doc */
+    0,                                        /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    PyObject_SelfIter,                        /* tp_iter */
+    (iternextfunc)PyBobIoMatlabBlockReader_Next, /* tp_iternext */
+    0,                                          /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    (initproc)PyBobIoMatlabBlockReader_Init,    /* tp_init */
+    0,                                          /* tp_alloc */
+    PyBobIoMatlabBlockReader_New,               /* tp_new */
+};
@@ -15,6 +15,7 @@ bobskin::bobskin(PyArrayObject* array, bob::io::base::array::ElementType eltype)
       PyArray_STRIDES((PyArrayObject*)array));
 
   m_ptr = PyArray_DATA((PyArrayObject*)array);
+  m_array = (PyObject*)array;
 
 }
 
@@ -35,12 +36,27 @@ void bobskin::set (const bob::io::base::array::typeinfo&) {
   throw std::runtime_error("error is already set");
 }
 
+/**
+ * Releases a reference to a Python object, when the last pointer to its
+ * memory goes away. This may happen on threads not holding the GIL.
+ */
+struct pyobject_releaser {
+  PyObject* object;
+  void operator() (const void*) const {
+    PyGILState_STATE state = PyGILState_Ensure();
+    Py_DECREF(object);
+    PyGILState_Release(state);
+  }
+};
+
 boost::shared_ptr<void> bobskin::owner() {
-  PyErr_SetString(PyExc_NotImplementedError, "acquiring non-const owner from C++ bobskin is not implemented - DEBUG ME!");
-  throw std::runtime_error("error is already set");
+  Py_INCREF(m_array);
+  pyobject_releaser releaser = {m_array};
+  return boost::shared_ptr<void>(m_ptr, releaser);
 }
 
 boost::shared_ptr<const void> bobskin::owner() const {
-  PyErr_SetString(PyExc_NotImplementedError, "acquiring const owner from C++ bobskin is not implemented - DEBUG ME!");
-  throw std::runtime_error("error is already set");
+  Py_INCREF(m_array);
+  pyobject_releaser releaser = {m_array};
+  return boost::shared_ptr<const void>(m_ptr, releaser);
 }
@@ -68,7 +68,9 @@ class bobskin: public bob::io::base::array::interface {
 
     /**
      * @brief Returns a representation of the internal cache using shared
-     * pointers.
+     * pointers. The returned pointers keep the numpy array alive. This must
+     * be called with the GIL held, but the pointers may be released from
+     * any thread.
      */
     virtual boost::shared_ptr<void> owner();
     virtual boost::shared_ptr<const void> owner() const;
@@ -77,6 +79,7 @@ class bobskin: public bob::io::base::array::interface {
 
     bob::io::base::array::typeinfo m_type; ///< type information
     void* m_ptr; ///< pointer to the data
+    PyObject* m_array; ///< the array the data belongs to (borrowed)
 
 };
 
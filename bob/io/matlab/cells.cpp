@@ -0,0 +1,246 @@
+/**
+ * @date Fri 16 Oct 16:10:38 2026 UTC
+ *
+ * @brief Python sequence over the elements of a matlab cell array, decoded as
+ * they are indexed
+ */
+
+#include <bob.blitz/capi.h>
+#include <bob.blitz/cleanup.h>
+#include <bob.io.base/api.h>
+
+#include "main.h"
+#include "gil.h"
+
+PyDoc_STRVAR(s_cell_array_str, BOB_EXT_MODULE_PREFIX ".CellArray");
+
+PyDoc_STRVAR(s_cell_array_doc,
+"CellArray(path, varname) -> new cell array\n\
+\n\
+Gives access to a cell array stored in a Matlab(R) file.\n\
+\n\
+The cell array behaves as a (read-only) sequence, of the elements of the\n\
+cell array in column-major order, as with Matlab(R) linear indexing. Only\n\
+the header of the cell array is read on construction: each element is\n\
+decoded when it is indexed, so ``list(cell_array)`` reads them all. The\n\
+file is kept open while the cell array exists.\n\
+\n\
+Elements are returned as numpy arrays, or as :py:class:`CellArray`\n\
+objects for nested cell arrays. Elements that are neither are returned as\n\
+``None``.\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file from which you wish to read the cell array.\n\
+\n\
+varname, string\n\
+  One of the values returned by :py:func:`read_varnames`\n\
+\n\
+");
+
+static PyObject* PyBobIoMatlabCellArray_New(PyTypeObject* type, PyObject*, PyObject*) {
+
+  /* Allocates the python object itself */
+  PyBobIoMatlabCellArrayObject* self = (PyBobIoMatlabCellArrayObject*)type->tp_alloc(type, 0);
+
+  self->cxx.reset();
+
+  return reinterpret_cast<PyObject*>(self);
+}
+
+static void PyBobIoMatlabCellArray_Delete (PyBobIoMatlabCellArrayObject* o) {
+
+  o->cxx.reset();
+  Py_TYPE(o)->tp_free((PyObject*)o);
+
+}
+
+static int PyBobIoMatlabCellArray_Init(PyBobIoMatlabCellArrayObject* self, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", "varname", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+  const char* varname;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&s", kwlist,
+        &PyBobIo_FilenameConverter, &filename, &varname)) return -1;
+
+  try {
+    boost::shared_ptr<mat_t> matfile;
+    boost::shared_ptr<matvar_t> header;
+    {
+      gil_release nogil;
+      matfile = make_matfile(filename, MAT_ACC_RDONLY);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+      if (matfile) header = read_header(matfile, varname);
+    }
+
+    if (!matfile) {
+      PyErr_Format(PyExc_RuntimeError,
+          "Could open the matlab file `%s'", filename);
+      return -1;
+    }
+
+    if (!header) {
+      PyErr_Format(PyExc_RuntimeError, "Cannot locate variable `%s' in file '%s'", varname, filename);
+      return -1;
+    }
+    self->cxx.reset(new mat_cell_reader(matfile, header));
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return -1;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read variable `%s' at matlab file `%s' as a cell array", varname, filename);
+    return -1;
+  }
+
+  return 0; ///< SUCCESS
+}
+
+static Py_ssize_t PyBobIoMatlabCellArray_Len (PyBobIoMatlabCellArrayObject* self) {
+  if (!PyBobIoMatlab_CheckInitialized(self)) return -1;
+  return self->cxx->size();
+}
+
+static PyObject* PyBobIoMatlabCellArray_GetItem (PyBobIoMatlabCellArrayObject* self, Py_ssize_t i) {
+
+  if (!PyBobIoMatlab_CheckInitialized(self)) return 0;
+
+  if (i < 0 || (size_t)i >= self->cxx->size()) {
+    PyErr_Format(PyExc_IndexError, "cell array index out of range");
+    return 0;
+  }
+
+  try {
+    if (self->cxx->is_cell(i)) {
+      PyBobIoMatlabCellArrayObject* retval = (PyBobIoMatlabCellArrayObject*)
+        PyBobIoMatlabCellArray_New(&PyBobIoMatlabCellArray_Type, 0, 0);
+      if (!retval) return 0;
+      retval->cxx = self->cxx->cell(i);
+      return reinterpret_cast<PyObject*>(retval);
+    }
+
+    mat_type type;
+    self->cxx->type(i, type);
+    if (type.dtype == bob::io::base::array::t_unknown) Py_RETURN_NONE;
+
+    if (type.shape.size() > NPY_MAXDIMS) {
+      PyErr_Format(PyExc_RuntimeError, "matlab array has %d dimensions, more than the maximum supported by numpy (%d)", (int)type.shape.size(), NPY_MAXDIMS);
+      return 0;
+    }
+    npy_intp shape[NPY_MAXDIMS];
+    std::copy(type.shape.begin(), type.shape.end(), shape);
+
+    int type_num = PyBobIo_AsTypenum(type.dtype);
+    if (type_num == NPY_NOTYPE) return 0; ///< failure
+
+    PyObject* retval = PyArray_SimpleNew(type.shape.size(), shape, type_num);
+    if (!retval) return 0;
+    auto retval_ = make_safe(retval);
+
+    {
+      void* data = PyArray_DATA((PyArrayObject*)retval);
+      gil_release nogil;
+      self->cxx->read(i, type, data);
+    }
+
+    return Py_BuildValue("O", retval);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "%s: cannot read element %zd", Py_TYPE(self)->tp_name, i);
+    return 0;
+  }
+
+}
+
+static PySequenceMethods PyBobIoMatlabCellArray_Sequence = {
+    (lenfunc)PyBobIoMatlabCellArray_Len,
+    0, /* concat */
+    0, /* repeat */
+    (ssizeargfunc)PyBobIoMatlabCellArray_GetItem, /* item */
+    0, /* slice */
+    0, /* ass_item */
+    0, /* ass_slice */
+    0, /* contains */
+    0, /* inplace_concat */
+    0, /* inplace_repeat */
+};
+
+PyDoc_STRVAR(s_shape_str, "shape");
+PyDoc_STRVAR(s_shape_doc, "The shape of the cell array, as in Matlab(R)");
+
+static PyObject* PyBobIoMatlabCellArray_Shape (PyBobIoMatlabCellArrayObject* self, void*) {
+
+  if (!PyBobIoMatlab_CheckInitialized(self)) return 0;
+
+  const std::vector<size_t>& shape = self->cxx->shape();
+  PyObject* retval = PyTuple_New(shape.size());
+  if (!retval) return 0;
+  for (size_t k=0; k<shape.size(); ++k) {
+    PyTuple_SET_ITEM(retval, k, Py_BuildValue("n", shape[k]));
+  }
+  return retval;
+
+}
+
+static PyGetSetDef PyBobIoMatlabCellArray_getseters[] = {
+    {
+      s_shape_str,
+      (getter)PyBobIoMatlabCellArray_Shape,
+      0,
+      s_shape_doc,
+      0,
+    },
+    {0}  /* Sentinel */
+};
+
+PyTypeObject PyBobIoMatlabCellArray_Type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    s_cell_array_str,                           /*tp_name*/
+    sizeof(PyBobIoMatlabCellArrayObject),       /*tp_basicsize*/
+    0,                                          /*tp_itemsize*/
+    (destructor)PyBobIoMatlabCellArray_Delete,  /*tp_dealloc*/
+    0,                                          /*tp_print*/
+    0,                                          /*tp_getattr*/
+    0,                                          /*tp_setattr*/
+    0,                                          /*tp_compare*/
+    0,                                          /*tp_repr*/
+    0,                                          /*tp_as_number*/
+    &PyBobIoMatlabCellArray_Sequence,           /*tp_as_sequence*/
+    0,                                          /*tp_as_mapping*/
+    0,                                          /*tp_hash */
+    0,                                          /*tp_call*/
+    0,                                          /*tp_str*/
+    0,                                          /*tp_getattro*/
+    0,                                          /*tp_setattro*/
+    0,                                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,                         /*tp_flags*/
+    s_cell_array_doc,                           /* tp_doc */
+    0,                                        /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    0,                                        /* tp_iter */
+    0,                                        /* tp_iternext */
+    0,                                          /* tp_methods */
+    0,                                          /* tp_members */
+    PyBobIoMatlabCellArray_getseters,           /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    (initproc)PyBobIoMatlabCellArray_Init,      /* tp_init */
+    0,                                          /* tp_alloc */
+    PyBobIoMatlabCellArray_New,                 /* tp_new */
+};
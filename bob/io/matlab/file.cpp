@@ -8,39 +8,88 @@
  */
 
 #include <algorithm>
+#include <mutex>
 #include <boost/make_shared.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 
 #include "utils.h"
 #include "file.h"
+#include "gil.h"
 
 /**
- * TODO:
- * 1. Current known limitation: does not support full read-out of all data if
- * an array_read() is issued. What we do, presently, is just to read the first
- * variable.
+ * Files with many variables of the same type (e.g. written with append()) are
+ * read by read_all() as a single array, stacking all variables along a new
+ * first dimension. If the variables differ, or there are too many dimensions
+ * to stack them, read_all() only reads the first variable.
  */
 class MatFile: public bob::io::base::File {
 
   public: //api
 
-    MatFile(const char* path, char mode):
+    MatFile(const char* path, char mode, const mat_options& options):
       m_filename(path),
       m_mode( (mode=='r')? MAT_ACC_RDONLY : MAT_ACC_RDWR ),
-      m_map(new std::map<size_t, std::pair<std::string, bob::io::base::array::typeinfo> >()),
-      m_size(0) {
+      m_options(options),
+      m_map(new map_type()),
+      m_size(0),
+      m_uniform(true),
+      m_mat73(is_mat73(path)) {
+        std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
         if (mode == 'r' || mode == 'a') try_reload_map();
         if (mode == 'w' && boost::filesystem::exists(path)) boost::filesystem::remove(path);
       }
 
-    virtual ~MatFile() { }
+    virtual ~MatFile() { close(); }
+
+    /**
+     * Returns the matio handle to this file, opening it on the first call.
+     * The same handle is then re-used by all subsequent reads and writes
+     * until close() is called.
+     */
+    boost::shared_ptr<mat_t> handle() {
+      if (!m_mat) {
+        boost::shared_ptr<mat_t> mat = make_matfile(m_filename.c_str(), m_mode,
+            m_options.version);
+        if (!mat) {
+          boost::format f("cannot open matlab file at '%s'");
+          f % m_filename;
+          throw std::runtime_error(f.str());
+        }
+        m_mat = mat;
+        m_mat73 = is_mat73(mat.get());
+      }
+      return m_mat;
+    }
+
+    /**
+     * Locks the HDF5 library if this file is, or is going to be created as,
+     * a v7.3 file, see lock_hdf5(). The format of the file on disk is only
+     * looked up on construction, and then taken from the matio handle.
+     */
+    std::unique_lock<std::recursive_mutex> lock_hdf5() {
+      return ::lock_hdf5(m_mat73 || m_options.version == MAT_FT_MAT73);
+    }
+
+    /**
+     * Closes the matio handle, which flushes any data written so far to
+     * disk. The file is re-opened lazily on the next read or write.
+     */
+    void close() {
+      //cached headers are bound to the handle they were read from
+      for (map_type::iterator it = m_map->begin(); it != m_map->end(); ++it) {
+        it->second.header.reset();
+      }
+      m_mat.reset();
+    }
 
     void try_reload_map () {
       if (boost::filesystem::exists(m_filename)) {
-        m_map = list_variables(m_filename.c_str());
-        m_type = m_map->begin()->second.second;
+        m_map = list_variables(handle());
+        if (m_map->empty()) return;
+        m_type = m_map->begin()->second.type;
         m_size = m_map->size();
+        m_id.clear();
         m_id.reserve(m_size);
         for (map_type::iterator
             it = m_map->begin(); it != m_map->end(); ++it) {
@@ -48,10 +97,23 @@ class MatFile: public bob::io::base::File {
         }
         std::sort(m_id.begin(), m_id.end()); //get the right order...
 
+        m_uniform = true;
+        for (map_type::iterator
+            it = m_map->begin(); it != m_map->end(); ++it) {
+          if (!it->second.type.is_compatible(m_type)) m_uniform = false;
+        }
+        update_type_all();
+
         //double checks some parameters
-        if (m_type.nd == 0 || m_type.nd > 4) {
-          boost::format m("number of dimensions for object at file `%s' (%u) exceeds the maximum supported (%u)");
-          m % m_filename % m_type.nd % BOB_MAX_DIM;
+        if (m_map->begin()->second.header->class_type == MAT_C_CELL) {
+          boost::format m("object `%s' at file `%s' is a cell array - use bob.io.matlab.CellArray instead");
+          m % m_map->begin()->second.name % m_filename;
+          throw std::runtime_error(m.str());
+        }
+        size_t nd = m_map->begin()->second.header->rank;
+        if (nd == 0 || nd > BOB_MAX_DIM) {
+          boost::format m("number of dimensions for object at file `%s' (%u) exceeds the maximum supported (%u) - use bob.io.matlab.read_matrix() instead");
+          m % m_filename % nd % BOB_MAX_DIM;
           throw std::runtime_error(m.str());
         }
         if (m_type.dtype == bob::io::base::array::t_unknown) {
@@ -67,13 +129,27 @@ class MatFile: public bob::io::base::File {
     }
 
     virtual const bob::io::base::array::typeinfo& type_all () const {
-      return m_type;
+      return m_type_all;
     }
 
     virtual const bob::io::base::array::typeinfo& type () const {
       return m_type;
     }
 
+    /**
+     * Returns the type of the variable at the given index, as found on its
+     * own header. type() only describes the first variable in the file, use
+     * this to allocate buffers that fit each variable exactly.
+     */
+    const bob::io::base::array::typeinfo& type (size_t index) const {
+      if (index >= m_id.size()) {
+        boost::format f("index %u is out of range for matlab file `%s', which contains %u variables");
+        f % index % m_filename % m_id.size();
+        throw std::out_of_range(f.str());
+      }
+      return m_map->find(m_id[index])->second.type;
+    }
+
     virtual size_t size() const {
       return m_size;
     }
@@ -82,124 +158,240 @@ class MatFile: public bob::io::base::File {
       return s_codecname.c_str();
     }
 
+    /**
+     * Reading happens without the GIL, so other Python threads may run in the
+     * meanwhile. The buffer we get from Python may only be re-allocated while
+     * holding the GIL, so we do it beforehand, and then read into a view of
+     * its memory.
+     */
     virtual void read_all(bob::io::base::array::interface& buffer) {
 
-      //do we need to reload the file?
-      if (!m_type.is_valid()) try_reload_map();
+      bob::io::base::array::typeinfo info;
+
+      {
+        gil_release nogil;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
+
+        //do we need to reload the file?
+        if (!m_type.is_valid()) try_reload_map();
+        info = m_type_all;
+      }
+
+      if (info.is_valid() && !buffer.type().is_compatible(info)) buffer.set(info);
+      array_buffer view(buffer.ptr(), buffer.type());
 
-      //now open it for reading
-      boost::shared_ptr<mat_t> mat = make_matfile(m_filename.c_str(), m_mode);
+      gil_release nogil;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
 
-      if (!mat) {
-        boost::format f("uninitialized matlab file (%s) cannot be read");
+      if (info.is_valid() && !m_type_all.is_compatible(info)) {
+        boost::format f("matlab file `%s' was modified while being read");
         f % m_filename;
         throw std::runtime_error(f.str());
       }
 
-      read_array(mat, buffer);
+      boost::shared_ptr<mat_t> mat = handle();
+
+      if (m_type_all.nd == m_type.nd + 1) {
+        //stacked variables, each decoded straight into its own slice
+        const size_t bytes = m_type.buffer_size();
+        char* ptr = static_cast<char*>(view.ptr());
+        for (size_t k=0; k<m_id.size(); ++k) {
+          array_buffer slice(ptr + k*bytes, m_type);
+          read_array(mat, header(k), slice, m_options.threads);
+        }
+        return;
+      }
+
+      //the handle is shared, so make sure we read the first variable
+      Mat_Rewind(mat.get());
+      read_array(mat, view, 0, m_options.threads);
 
     }
 
     virtual void read(bob::io::base::array::interface& buffer, size_t index) {
 
-      //do we need to reload the file?
-      if (!m_type.is_valid()) try_reload_map();
+      bob::io::base::array::typeinfo info;
 
-      //now open it for reading
-      boost::shared_ptr<mat_t> mat = make_matfile(m_filename.c_str(), m_mode);
+      {
+        gil_release nogil;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
 
-      if (!mat) {
-        boost::format f("uninitialized matlab file (%s) cannot be read");
-        f % m_filename;
+        //do we need to reload the file?
+        if (!m_type.is_valid()) try_reload_map();
+        info = type(index); ///< checks index is in range
+      }
+
+      if (info.dtype == bob::io::base::array::t_unknown) {
+        boost::format f("unsupported data type for variable %u in matlab file `%s'");
+        f % index % m_filename;
         throw std::runtime_error(f.str());
       }
 
-      read_array(mat, buffer, (*m_map)[m_id[index]].first.c_str());
+      if (!buffer.type().is_compatible(info)) buffer.set(info);
+      array_buffer view(buffer.ptr(), buffer.type());
 
-    }
+      gil_release nogil;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
 
-    virtual size_t append (const bob::io::base::array::interface& buffer) {
+      type(index); ///< the file may have been re-written in the meanwhile
+      read_array(handle(), header(index), view, m_options.threads);
 
-      //do we need to reload the file?
-      if (!m_type.is_valid()) try_reload_map();
+    }
 
-      //now open it for writing.
-      boost::shared_ptr<mat_t> mat =
-        make_matfile(m_filename.c_str(), m_mode);
+    virtual size_t append (const bob::io::base::array::interface& buffer) {
 
-      if (!mat) {
-        boost::format f("cannot open matlab file at '%s' for writing");
-        f % m_filename;
-        throw std::runtime_error(f.str());
-      }
+      gil_release nogil;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
 
-      //checks typing is right
-      if (m_type.is_valid() && !m_type.is_compatible(buffer.type())) {
-        boost::format f("cannot append with different buffer type (%s) than the one already initialized (%s)");
-        f % buffer.type().str() % m_type.str();
-        throw std::runtime_error(f.str());
-      }
+      return append_one(buffer);
+    }
 
-      //all is good at this point, just write it.
+    /**
+     * Appends many buffers at once, in a single session on the file. Returns
+     * the index of the first appended buffer.
+     */
+    size_t append_many
+      (const std::vector<const bob::io::base::array::interface*>& buffers) {
 
-      //choose variable name
-      size_t next_index = 0;
-      if (m_id.size()) next_index = *m_id.rbegin() + 1;
-      std::ostringstream varname("array_");
-      varname << next_index;
+      gil_release nogil;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
 
-      write_array(mat, varname.str().c_str(), buffer);
+      size_t first = m_size;
+      for (size_t k=0; k<buffers.size(); ++k) append_one(*buffers[k]);
+      return first;
+    }
 
-      mat.reset(); ///< force data flushing
+    /**
+     * Makes sure everything appended so far is on disk, by closing the
+     * handle. It is re-opened on the next read or write.
+     */
+    void flush() {
 
-      if (!m_type.is_valid()) try_reload_map();
-      else {
-        //optimization: don't reload the map, just update internal cache
-        ++m_size;
-        (*m_map)[next_index] = std::make_pair(varname.str(), buffer.type());
-        m_id.push_back(next_index);
-      }
+      gil_release nogil;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
 
-      return m_size-1;
+      close();
     }
 
     virtual void write (const bob::io::base::array::interface& buffer) {
 
       static const char* varname = "array";
 
+      gil_release nogil;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5();
+
       //this file is supposed to hold a single array. delete it if it exists
+      close();
       boost::filesystem::path path (m_filename);
       if (boost::filesystem::exists(m_filename)) boost::filesystem::remove(m_filename);
 
-      boost::shared_ptr<mat_t> mat = make_matfile(m_filename.c_str(),
-          m_mode);
-      if (!mat) {
-        boost::format f("cannot open matlab file at '%s' for writing");
-        f % m_filename;
-        throw std::runtime_error(f.str());
-      }
-
-      write_array(mat, varname, buffer);
+      write_array(handle(), varname, buffer, m_options);
 
-      mat.reset(); ///< forces data flushing (not really required here...)
+      close(); ///< forces data flushing (not really required here...)
 
       //updates internal map w/o looking to the output file.
       m_size = 1;
-      (*m_map)[0] = std::make_pair(varname, buffer.type());
+      m_map->clear();
+      (*m_map)[0].name = varname;
+      (*m_map)[0].type = buffer.type();
+      m_id.clear();
       m_id.push_back(0);
+      m_type = buffer.type();
+      m_uniform = true;
+      update_type_all();
+
+    }
+
+  private: //helpers
+
+    /**
+     * Returns the header of the variable at the given index. Variables we
+     * appended ourselves have no header yet, in which case we read them all
+     * at once, instead of searching the file for each of them.
+     */
+    boost::shared_ptr<matvar_t> header (size_t index) {
+      if (!(*m_map)[m_id[index]].header) try_reload_map(); ///< replaces m_map
+      const mat_variable& var = (*m_map)[m_id[index]];
+      if (!var.header) {
+        boost::format f("cannot locate variable `%s' in matlab file `%s'");
+        f % var.name % m_filename;
+        throw std::runtime_error(f.str());
+      }
+      return var.header;
+    }
+
+    /**
+     * Updates the type returned by type_all(), stacking all variables if they
+     * have the same type and the result does not have too many dimensions
+     */
+    void update_type_all () {
+      m_type_all = m_type;
+      if (m_size < 2 || !m_uniform || m_type.nd >= BOB_MAX_DIM) return;
+      size_t shape[BOB_MAX_DIM];
+      shape[0] = m_size;
+      for (size_t k=0; k<m_type.nd; ++k) shape[k+1] = m_type.shape[k];
+      m_type_all.set_shape<size_t>(m_type.nd + 1, shape);
+    }
+
+    /**
+     * Appends a buffer to the file, which stays open. The map of variables is
+     * updated in place, instead of being reloaded from the file.
+     */
+    size_t append_one (const bob::io::base::array::interface& buffer) {
+
+      //checks typing is right
+      if (m_type.is_valid() && !m_type.is_compatible(buffer.type())) {
+        boost::format f("cannot append with different buffer type (%s) than the one already initialized (%s)");
+        f % buffer.type().str() % m_type.str();
+        throw std::runtime_error(f.str());
+      }
+
+      //all is good at this point, just write it.
+
+      //choose variable name
+      size_t next_index = 0;
+      if (m_id.size()) next_index = *m_id.rbegin() + 1;
+      std::ostringstream varname;
+      varname << "array_" << next_index;
 
+      write_array(handle(), varname.str().c_str(), buffer, m_options);
+
+      //the first variable sets the type of the file
+      if (!m_type.is_valid()) m_type = buffer.type();
+      ++m_size;
+      mat_variable& var = (*m_map)[next_index];
+      var.name = varname.str();
+      var.type = buffer.type();
+      m_id.push_back(next_index);
+      update_type_all();
+
+      return m_size-1;
     }
 
   private: //representation
 
-    typedef std::map<size_t, std::pair<std::string, bob::io::base::array::typeinfo> > map_type;
+    typedef mat_varmap map_type;
 
     std::string m_filename;
     enum mat_acc m_mode;
+    mat_options m_options;
+    boost::shared_ptr<mat_t> m_mat; ///< lazily opened, see handle()
     boost::shared_ptr<map_type> m_map;
-    bob::io::base::array::typeinfo m_type;
+    bob::io::base::array::typeinfo m_type; ///< type of the first variable
+    bob::io::base::array::typeinfo m_type_all; ///< see update_type_all()
     size_t       m_size;
+    bool m_uniform; ///< all variables have the same type
+    bool m_mat73; ///< the file is a v7.3 file, see lock_hdf5()
     std::vector<size_t> m_id;
+    std::mutex m_mutex; ///< serializes reads and writes, done without the GIL
 
     static std::string s_codecname;
 
@@ -228,5 +420,26 @@ std::string MatFile::s_codecname = "bob.matlab";
  * @note: This method can be static.
  */
 boost::shared_ptr<bob::io::base::File> make_file (const char* path, char mode) {
-  return boost::make_shared<MatFile>(path, mode);
+  return make_file(path, mode, default_options());
+}
+
+boost::shared_ptr<bob::io::base::File> make_file (const char* path, char mode,
+    const mat_options& options) {
+  return boost::make_shared<MatFile>(path, mode, options);
+}
+
+size_t append_many (bob::io::base::File& file,
+    const std::vector<const bob::io::base::array::interface*>& buffers) {
+
+  MatFile* matfile = dynamic_cast<MatFile*>(&file);
+  if (matfile) return matfile->append_many(buffers);
+
+  size_t first = file.size();
+  for (size_t k=0; k<buffers.size(); ++k) file.append(*buffers[k]);
+  return first;
+}
+
+void flush (bob::io::base::File& file) {
+  MatFile* matfile = dynamic_cast<MatFile*>(&file);
+  if (matfile) matfile->flush();
 }
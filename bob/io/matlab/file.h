@@ -10,9 +10,12 @@
 #ifndef BOB_IO_MATLAB_FILE_H
 #define BOB_IO_MATLAB_FILE_H
 
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <bob.io.base/File.h>
 
+#include "utils.h"
+
 /**
  * This defines the factory method F that can create codecs of this type.
  *
@@ -35,4 +38,29 @@
  */
 boost::shared_ptr<bob::io::base::File> make_file (const char* path, char mode);
 
+/**
+ * Same as above, but lets you choose how data is written to the file instead
+ * of using default_options()
+ */
+boost::shared_ptr<bob::io::base::File> make_file (const char* path, char mode,
+    const mat_options& options);
+
+/**
+ * Appends all buffers to a file created by make_file(), in a single session.
+ * Variables are named after their index in the file (``array_<n>``), as with
+ * File::append(). Each one is written by matio as it is appended, through
+ * the handle the file keeps open until flush() is called or the file is
+ * destroyed. Returns the index of the first appended buffer. Files from
+ * other codecs get the buffers appended one by one.
+ */
+size_t append_many (bob::io::base::File& file,
+    const std::vector<const bob::io::base::array::interface*>& buffers);
+
+/**
+ * Closes the matio handle of a file created by make_file(), so that the file
+ * is complete on disk and may be opened by others. The handle is re-opened
+ * on the next read or write. This does nothing for files from other codecs.
+ */
+void flush (bob::io::base::File& file);
+
 #endif /* BOB_IO_MATLAB_FILE_H */
@@ -0,0 +1,50 @@
+/**
+ * @date Fri 16 Oct 15:53:46 2026 UTC
+ *
+ * @brief Releases the Python global interpreter lock (GIL) while doing I/O
+ */
+
+#ifndef BOB_IO_MATLAB_GIL_H
+#define BOB_IO_MATLAB_GIL_H
+
+#include <Python.h>
+
+/**
+ * Releases the GIL for as long as this object lives, and re-acquires it on
+ * destruction, also if an exception is thrown. Nothing happens if the
+ * calling thread does not hold the GIL (e.g. if we are called from C++ code
+ * that already released it).
+ *
+ * No Python API may be used while the GIL is released. In particular,
+ * bobskin buffers may not be re-allocated: read into an array_buffer
+ * referring to their memory instead.
+ */
+class gil_release {
+
+  public: //api
+
+    gil_release(): m_state(held() ? PyEval_SaveThread() : 0) { }
+
+    ~gil_release() { if (m_state) PyEval_RestoreThread(m_state); }
+
+  private: //helpers
+
+    static bool held() {
+#     if PY_VERSION_HEX >= 0x03040000
+      return PyGILState_Check();
+#     else
+      PyThreadState* state = _PyThreadState_Current;
+      return state && state == PyGILState_GetThisThreadState();
+#     endif
+    }
+
+    gil_release(const gil_release&);
+    gil_release& operator= (const gil_release&);
+
+  private: //representation
+
+    PyThreadState* m_state;
+
+};
+
+#endif /* BOB_IO_MATLAB_GIL_H */
@@ -9,114 +9,1825 @@
 #undef NO_IMPORT_ARRAY
 #endif
 
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <boost/format.hpp>
+
 #include <bob.blitz/capi.h>
 #include <bob.blitz/cleanup.h>
 #include <bob.core/api.h>
 #include <bob.io.base/api.h>
 
-#include "utils.h"
-#include "file.h"
-#include "bobskin.h"
+#include "utils.h"
+#include "file.h"
+#include "bobskin.h"
+#include "gil.h"
+#include "mapping.h"
+#include "main.h"
+
+PyDoc_STRVAR(s_read_varnames_str, "read_varnames");
+PyDoc_STRVAR(s_read_varnames_doc,
+"read_varnames(path) -> list\n\
+\n\
+Returns the list of variable names stored in the given Matlab(R) file.\n\
+"
+);
+
+PyObject* PyBobIoMatlab_ReadVarNames(PyObject*, PyObject* o) {
+
+  const char* filename;
+
+  if (!PyBobIo_FilenameConverter(o, &filename)) return 0;
+
+  try {
+    boost::shared_ptr<mat_varmap> list;
+    {
+      gil_release nogil;
+      list = list_variables(filename);
+    }
+
+    PyObject* retval = PyTuple_New(list->size());
+    if (!retval) return 0;
+    auto retval_ = make_safe(retval);
+
+    int k = 0;
+    for (auto it = list->begin(); it != list->end(); ++it, ++k) {
+      PyObject* item = Py_BuildValue("s", it->second.name.c_str());
+      if (!item) return 0;
+      PyTuple_SET_ITEM(retval, k, item);
+    }
+
+    return Py_BuildValue("O", retval);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read variable names from matlab file `%s'", filename);
+    return 0;
+  }
+
+}
+
+PyDoc_STRVAR(s_read_vartypes_str, "read_vartypes");
+PyDoc_STRVAR(s_read_vartypes_doc,
+"read_vartypes(path) -> tuple\n\
+\n\
+Returns the type of each variable stored in the given Matlab(R) file, in\n\
+the same order as :py:func:`read_varnames`. Each entry is a tuple\n\
+``(dtype, shape, stride)``, as returned by :py:func:`bob.io.base.peek`, or\n\
+``None`` if the variable type is not supported. Only the variable headers\n\
+are read, so this is cheap even for large files.\n\
+"
+);
+
+/**
+ * Same as PyBobIo_TypeInfoAsTuple(), for variables with more dimensions than
+ * a typeinfo can hold: returns the dtype, shape and strides (in elements) of
+ * the variable.
+ */
+static PyObject* type_as_tuple (const mat_type& type) {
+
+  int type_num = PyBobIo_AsTypenum(type.dtype);
+  if (type_num == NPY_NOTYPE) return 0;
+
+  size_t nd = type.shape.size();
+  PyObject* shape = PyTuple_New(nd);
+  if (!shape) return 0;
+  auto shape_ = make_safe(shape);
+  PyObject* stride = PyTuple_New(nd);
+  if (!stride) return 0;
+  auto stride_ = make_safe(stride);
+
+  Py_ssize_t step = 1;
+  for (size_t k=nd; k>0; --k) {
+    PyObject* item = Py_BuildValue("n", (Py_ssize_t)type.shape[k-1]);
+    if (!item) return 0;
+    PyTuple_SET_ITEM(shape, k-1, item);
+    item = Py_BuildValue("n", step);
+    if (!item) return 0;
+    PyTuple_SET_ITEM(stride, k-1, item);
+    step *= type.shape[k-1];
+  }
+
+  return Py_BuildValue("NOO", PyArray_DescrFromType(type_num), shape, stride);
+
+}
+
+PyObject* PyBobIoMatlab_ReadVarTypes(PyObject*, PyObject* o) {
+
+  const char* filename;
+
+  if (!PyBobIo_FilenameConverter(o, &filename)) return 0;
+
+  try {
+    boost::shared_ptr<mat_varmap> list;
+    {
+      gil_release nogil;
+      list = list_variables(filename);
+    }
+
+    PyObject* retval = PyTuple_New(list->size());
+    if (!retval) return 0;
+    auto retval_ = make_safe(retval);
+
+    int k = 0;
+    for (auto it = list->begin(); it != list->end(); ++it, ++k) {
+      PyObject* item = 0;
+      mat_type type;
+      mat_peek(it->second.header, type);
+      if (type.dtype == bob::io::base::array::t_unknown) {
+        Py_INCREF(Py_None);
+        item = Py_None;
+      }
+      else if (type.shape.size() <= BOB_MAX_DIM) {
+        item = PyBobIo_TypeInfoAsTuple(it->second.type);
+        if (!item) return 0;
+      }
+      else {
+        item = type_as_tuple(type);
+        if (!item) return 0;
+      }
+      PyTuple_SET_ITEM(retval, k, item);
+    }
+
+    return Py_BuildValue("O", retval);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read variable types from matlab file `%s'", filename);
+    return 0;
+  }
+
+}
+
+/**
+ * Deletes the owner of the memory of a numpy array when it is collected
+ */
+static void delete_owner (PyObject* capsule) {
+  delete static_cast<boost::shared_ptr<const void>*>(PyCapsule_GetPointer(capsule, 0));
+}
+
+/**
+ * Makes the numpy array keep owner alive, for as long as it lives
+ */
+static bool set_owner (PyObject* array, boost::shared_ptr<const void> owner) {
+
+  boost::shared_ptr<const void>* copy = new boost::shared_ptr<const void>(owner);
+  PyObject* capsule = PyCapsule_New(copy, 0, delete_owner);
+  if (!capsule) {
+    delete copy;
+    return false;
+  }
+  return PyArray_SetBaseObject((PyArrayObject*)array, capsule) == 0;
+
+}
+
+PyObject* PyBobIoMatlab_BufferAsPython (bob::io::base::array::interface& buf) {
+
+  const bob::io::base::array::typeinfo& info = buf.type();
+
+  int type_num = PyBobIo_AsTypenum(info.dtype);
+  if (type_num == NPY_NOTYPE) return 0; ///< failure
+
+  npy_intp shape[NPY_MAXDIMS];
+  for (size_t k=0; k<info.nd; ++k) shape[k] = info.shape[k];
+
+  PyObject* retval = PyArray_SimpleNewFromData(info.nd, shape, type_num,
+      buf.ptr());
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  if (!set_owner(retval, buf.owner())) return 0;
+
+  return Py_BuildValue("O", retval);
+
+}
+
+/**
+ * Converts the shape of a variable into numpy's, which is limited to
+ * NPY_MAXDIMS dimensions. Returns false and sets an error if it does not fit.
+ */
+static bool numpy_shape (const mat_type& type, npy_intp* shape) {
+
+  if (type.shape.size() > NPY_MAXDIMS) {
+    PyErr_Format(PyExc_RuntimeError, "matlab array has %d dimensions, more than the maximum supported by numpy (%d)", (int)type.shape.size(), NPY_MAXDIMS);
+    return false;
+  }
+
+  std::copy(type.shape.begin(), type.shape.end(), shape);
+  return true;
+
+}
+
+/**
+ * Creates a read-only, Fortran-ordered numpy array viewing the memory mapped
+ * data of a variable. The array keeps the mapping alive.
+ */
+static PyObject* adopt_mapping (boost::shared_ptr<const void> data,
+    const mat_type& type) {
+
+  int type_num = PyBobIo_AsTypenum(type.dtype);
+  if (type_num == NPY_NOTYPE) return 0; ///< failure
+
+  npy_intp shape[NPY_MAXDIMS];
+  if (!numpy_shape(type, shape)) return 0;
+
+  PyObject* retval = PyArray_New(&PyArray_Type, type.shape.size(), shape,
+      type_num, 0, const_cast<void*>(data.get()), 0, NPY_ARRAY_FARRAY_RO, 0);
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  if (!set_owner(retval, data)) return 0;
+
+  return Py_BuildValue("O", retval);
+
+}
+
+PyObject* PyBobIoMatlab_TextAsPython (const std::vector<uint16_t>& text,
+    size_t rows, size_t cols) {
+
+  // code units are in the byte order of this machine
+  const uint16_t probe = 1;
+  int byteorder = *reinterpret_cast<const char*>(&probe) ? -1 : 1;
+
+  if (rows <= 1) {
+    return PyUnicode_DecodeUTF16(reinterpret_cast<const char*>(text.data()),
+        2*text.size(), "replace", &byteorder);
+  }
+
+  PyObject* retval = PyList_New(rows);
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+  for (size_t k=0; k<rows; ++k) {
+    int order = byteorder;
+    PyObject* row = PyUnicode_DecodeUTF16(
+        reinterpret_cast<const char*>(text.data() + k*cols), 2*cols,
+        "replace", &order);
+    if (!row) return 0;
+    PyList_SET_ITEM(retval, k, row);
+  }
+  return Py_BuildValue("O", retval);
+
+}
+
+/**
+ * Reads a char array, see PyBobIoMatlab_TextAsPython()
+ */
+static PyObject* read_text (boost::shared_ptr<mat_t> matfile,
+    boost::shared_ptr<matvar_t> header, const char* filename) {
+
+  std::vector<uint16_t> text;
+  size_t rows, cols;
+  {
+    gil_release nogil;
+    std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+    read_char(matfile, header, text, rows, cols, default_options().threads);
+  }
+
+  return PyBobIoMatlab_TextAsPython(text, rows, cols);
+
+}
+
+PyDoc_STRVAR(s_read_matrix_str, "read_matrix");
+PyDoc_STRVAR(s_read_matrix_doc,
+"read_matrix(path, [varname, [mmap, [order]]]) -> array\n\
+\n\
+Reads the matlab matrix with the given varname from the given file.\n\
+\n\
+Logical arrays are returned as boolean arrays, with one byte per element.\n\
+Char arrays are returned as strings, decoded from UTF-16: a single string\n\
+for arrays with one row, or a list with one string per row otherwise.\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file from which you wisht to read the matrix from.\n\
+\n\
+varname, string (optional)\n\
+  If this parameter is not specified, the first matrix will be returned.\n\
+  Otherwise, specify here one of the values returned by\n\
+  :py:func:`read_varnames`\n\
+\n\
+mmap, bool (optional)\n\
+  If set to ``True``, the file is mapped to memory and the returned\n\
+  array is a read-only, Fortran-ordered view of the variable data on the\n\
+  file, with no copy. Memory mapped files are shared by all processes\n\
+  reading them. This is only possible for real, numeric (or logical)\n\
+  variables stored uncompressed in version 5 files, in the byte order of\n\
+  this machine.\n\
+  Other variables are read as usual.\n\
+\n\
+order, str (optional)\n\
+  The memory layout of the returned array: ``'C'`` (the default) for\n\
+  row-major order, or ``'F'`` for column-major (Fortran) order. Matlab(R)\n\
+  stores data in column-major order, so the latter is read without\n\
+  re-ordering. Memory mapped arrays are always in column-major order.\n\
+\n\
+");
+
+PyObject* PyBobIoMatlab_ReadMatrix(PyObject*, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", "varname", "mmap", "order", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+  const char* varname = 0;
+  PyObject* mmap = Py_False;
+  const char* order = "C";
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|zOs", kwlist,
+        &PyBobIo_FilenameConverter, &filename, &varname, &mmap, &order)) return 0;
+
+  int map = PyObject_IsTrue(mmap);
+  if (map < 0) return 0;
+
+  std::string order_(order);
+  if (order_ != "C" && order_ != "F") {
+    PyErr_Format(PyExc_ValueError, "order should be either 'C' or 'F', not `%s'", order);
+    return 0;
+  }
+  bool col_major = (order_ == "F");
+
+  try {
+    if (map) {
+      mat_type type;
+      boost::shared_ptr<const void> data;
+      {
+        gil_release nogil;
+        data = map_variable(filename, varname, type);
+      }
+      if (data) return adopt_mapping(data, type);
+    }
+
+    boost::shared_ptr<mat_t> matfile;
+    boost::shared_ptr<matvar_t> header;
+    mat_type type;
+
+    // opens the file and gets the type of data, from the variable header only
+    {
+      gil_release nogil;
+      matfile = make_matfile(filename, MAT_ACC_RDONLY);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+      if (matfile) header = read_header(matfile, varname);
+      if (header) mat_peek(header, type);
+    }
+
+    if (!matfile) {
+      PyErr_Format(PyExc_RuntimeError,
+          "Could open the matlab file `%s'", filename);
+      return 0;
+    }
+
+    if (!header) {
+      if (varname) PyErr_Format(PyExc_RuntimeError, "Cannot locate variable `%s' in file '%s'", varname, filename);
+      else PyErr_Format(PyExc_RuntimeError, "Cannot find any variable in file '%s'", filename);
+      return 0;
+    }
+
+    if (header->class_type == MAT_C_CHAR) return read_text(matfile, header, filename);
+
+    npy_intp shape[NPY_MAXDIMS];
+    if (!numpy_shape(type, shape)) return 0;
+
+    int type_num = PyBobIo_AsTypenum(type.dtype);
+    if (type_num == NPY_NOTYPE) return 0; ///< failure
+
+    PyObject* retval = PyArray_New(&PyArray_Type, type.shape.size(), shape,
+        type_num, 0, 0, 0, col_major ? NPY_ARRAY_F_CONTIGUOUS : 0, 0);
+    if (!retval) return 0;
+    auto retval_ = make_safe(retval);
+
+    // decodes the data straight from the position recorded on the header
+    {
+      void* data = PyArray_DATA((PyArrayObject*)retval);
+      gil_release nogil;
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+      read_array(matfile, header, type, data, default_options().threads,
+          col_major);
+    }
+
+    return Py_BuildValue("O", retval);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read contents of variable `%s' at matlab file `%s'", varname, filename);
+    return 0;
+  }
+
+}
+
+/**
+ * Converts a Python sequence of non-negative integers into a vector
+ */
+static bool sequence_as_sizes (PyObject* o, const char* name,
+    std::vector<size_t>& sizes) {
+
+  PyObject* seq = PySequence_Fast(o, "slice parameters must be sequences of integers");
+  if (!seq) return false;
+  auto seq_ = make_safe(seq);
+
+  Py_ssize_t length = PySequence_Fast_GET_SIZE(seq);
+  sizes.resize(length);
+  for (Py_ssize_t k=0; k<length; ++k) {
+    Py_ssize_t value = PyNumber_AsSsize_t(PySequence_Fast_GET_ITEM(seq, k), PyExc_OverflowError);
+    if (value == -1 && PyErr_Occurred()) return false;
+    if (value < 0) {
+      PyErr_Format(PyExc_ValueError, "entries of `%s' must be non-negative", name);
+      return false;
+    }
+    sizes[k] = value;
+  }
+
+  return true;
+}
+
+PyDoc_STRVAR(s_read_slice_str, "read_slice");
+PyDoc_STRVAR(s_read_slice_doc,
+"read_slice(path, varname, start, stride, count) -> array\n\
+\n\
+Reads part of the matlab matrix with the given varname from the given file.\n\
+\n\
+Only the requested elements are decoded, so this can be used to read a few\n\
+rows from matrices that would not fit in memory. ``start``, ``stride`` and\n\
+``count`` must have one entry per dimension of the matrix. On each\n\
+dimension, ``count`` elements are read, starting at ``start`` and skipping\n\
+``stride`` elements at a time (e.g. ``start=(10,0), stride=(1,1),\n\
+count=(5,n)`` reads rows 10 to 14 of a matrix with ``n`` columns).\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file from which you wish to read the matrix from.\n\
+\n\
+varname, string\n\
+  One of the values returned by :py:func:`read_varnames`\n\
+\n\
+start, sequence of int\n\
+  The index of the first element to read on each dimension\n\
+\n\
+stride, sequence of int or None\n\
+  The distance between elements to read on each dimension. If ``None``,\n\
+  contiguous elements are read.\n\
+\n\
+count, sequence of int\n\
+  The number of elements to read on each dimension. This is the shape of\n\
+  the returned array.\n\
+\n\
+");
+
+PyObject* PyBobIoMatlab_ReadSlice(PyObject*, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", "varname", "start", "stride", "count", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+  const char* varname;
+  PyObject* start_object;
+  PyObject* stride_object;
+  PyObject* count_object;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&sOOO", kwlist,
+        &PyBobIo_FilenameConverter, &filename, &varname, &start_object,
+        &stride_object, &count_object)) return 0;
+
+  std::vector<size_t> start, stride, count;
+  if (!sequence_as_sizes(start_object, "start", start)) return 0;
+  if (!sequence_as_sizes(count_object, "count", count)) return 0;
+  if (stride_object == Py_None) stride.assign(count.size(), 1);
+  else if (!sequence_as_sizes(stride_object, "stride", stride)) return 0;
+
+  try {
+    boost::shared_ptr<mat_t> matfile;
+    boost::shared_ptr<matvar_t> header;
+    bob::io::base::array::typeinfo info;
+
+    {
+      gil_release nogil;
+      matfile = make_matfile(filename, MAT_ACC_RDONLY);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+      if (matfile) header = read_header(matfile, varname);
+      if (header) mat_peek(header, info);
+    }
+
+    if (!matfile) {
+      PyErr_Format(PyExc_RuntimeError,
+          "Could open the matlab file `%s'", filename);
+      return 0;
+    }
+
+    if (!header) {
+      PyErr_Format(PyExc_RuntimeError, "Cannot locate variable `%s' in file '%s'", varname, filename);
+      return 0;
+    }
+
+    if (start.size() != info.nd || stride.size() != info.nd || count.size() != info.nd) {
+      PyErr_Format(PyExc_ValueError, "variable `%s' at matlab file `%s' has %d dimensions, but the slice was specified with start, stride and count of lengths %d, %d and %d", varname, filename, (int)info.nd, (int)start.size(), (int)stride.size(), (int)count.size());
+      return 0;
+    }
+
+    npy_intp shape[NPY_MAXDIMS];
+    for (size_t k=0; k<info.nd; ++k) shape[k] = count[k];
+
+    int type_num = PyBobIo_AsTypenum(info.dtype);
+    if (type_num == NPY_NOTYPE) return 0; ///< failure
+
+    PyObject* retval = PyArray_SimpleNew(info.nd, shape, type_num);
+    if (!retval) return 0;
+    auto retval_ = make_safe(retval);
+
+    {
+      info.set_shape<size_t>(info.nd, &count[0]);
+      array_buffer view(PyArray_DATA((PyArrayObject*)retval), info);
+      gil_release nogil;
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+      read_slice(matfile, header, &start[0], &stride[0], &count[0], view);
+    }
+
+    return Py_BuildValue("O", retval);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read slice of variable `%s' at matlab file `%s'", varname, filename);
+    return 0;
+  }
+
+}
+
+/**
+ * Returns the bob element type equivalent to the numpy array data type
+ */
+static bob::io::base::array::ElementType element_type (PyArrayObject* a) {
+
+  PyArray_Descr* descr = PyArray_DESCR(a);
+
+  switch (descr->kind) {
+    case 'b':
+      return bob::io::base::array::t_bool;
+    case 'i':
+      switch (descr->elsize) {
+        case 1: return bob::io::base::array::t_int8;
+        case 2: return bob::io::base::array::t_int16;
+        case 4: return bob::io::base::array::t_int32;
+        case 8: return bob::io::base::array::t_int64;
+      }
+      break;
+    case 'u':
+      switch (descr->elsize) {
+        case 1: return bob::io::base::array::t_uint8;
+        case 2: return bob::io::base::array::t_uint16;
+        case 4: return bob::io::base::array::t_uint32;
+        case 8: return bob::io::base::array::t_uint64;
+      }
+      break;
+    case 'f':
+      switch (descr->elsize) {
+        case 4: return bob::io::base::array::t_float32;
+        case 8: return bob::io::base::array::t_float64;
+      }
+      break;
+    case 'c':
+      switch (descr->elsize) {
+        case 8: return bob::io::base::array::t_complex64;
+        case 16: return bob::io::base::array::t_complex128;
+      }
+      break;
+  }
+
+  return bob::io::base::array::t_unknown;
+}
+
+/**
+ * Converts between the MAT_FT_* file versions and their names in Python
+ */
+static const char* version_name (int version) {
+  switch (version) {
+    case MAT_FT_MAT4: return "4";
+    case MAT_FT_MAT5: return "5";
+    case MAT_FT_MAT73: return "7.3";
+    default: return 0;
+  }
+}
+
+static bool version_from_name (const char* name, int& version) {
+  if (!name) version = 0;
+  else if (std::string(name) == "4") version = MAT_FT_MAT4;
+  else if (std::string(name) == "5") version = MAT_FT_MAT5;
+  else if (std::string(name) == "7.3") version = MAT_FT_MAT73;
+  else {
+    PyErr_Format(PyExc_ValueError, "unsupported matlab file version `%s' - choose one of '4', '5' or '7.3'", name);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Updates options with the (optional) values passed from Python
+ */
+static bool update_options (mat_options& options, PyObject* compression,
+    const char* version, Py_ssize_t chunk, Py_ssize_t threads=-1) {
+
+  if (compression) {
+    int value = PyObject_IsTrue(compression);
+    if (value < 0) return false;
+    options.compress = value;
+  }
+
+  if (version && !version_from_name(version, options.version)) return false;
+
+  if (chunk >= 0) options.chunk = chunk;
+
+  if (threads == 0) {
+    PyErr_SetString(PyExc_ValueError, "the number of threads must be at least 1");
+    return false;
+  }
+  if (threads > 0) options.threads = threads;
+
+  return true;
+}
+
+/**
+ * Returns the UTF-8 contents of a string object, which stay valid while the
+ * object lives, or 0 with an error set if it is not a string
+ */
+static const char* as_string (PyObject* o) {
+# if PY_VERSION_HEX >= 0x03000000
+  if (PyUnicode_Check(o)) return PyUnicode_AsUTF8(o);
+# else
+  if (PyString_Check(o)) return PyString_AsString(o);
+# endif
+  PyErr_SetString(PyExc_TypeError, "field names should be strings");
+  return 0;
+}
+
+/**
+ * Converts the value of a field to a C-contiguous numpy array, returning a
+ * new reference, or 0 with an error set
+ */
+static PyObject* field_array (PyObject* value,
+    bob::io::base::array::ElementType& eltype) {
+
+  PyObject* array = PyArray_FromAny(value, 0, 0, 0, NPY_ARRAY_CARRAY_RO, 0);
+  if (!array) return 0;
+
+  eltype = element_type((PyArrayObject*)array);
+  if (eltype == bob::io::base::array::t_unknown) {
+    PyErr_Format(PyExc_TypeError, "cannot write fields of type `%s' to matlab files", PyBlitzArray_TypenumAsString(PyArray_TYPE((PyArrayObject*)array)));
+    Py_DECREF(array);
+    return 0;
+  }
+
+  return array;
+
+}
+
+/**
+ * The type of the values of a field, given by the dimensions of its array
+ * from skip on. Scalars become 1x1 matrices, as in Matlab(R).
+ */
+static mat_type field_type (PyArrayObject* array,
+    bob::io::base::array::ElementType eltype, size_t skip) {
+  mat_type retval;
+  retval.dtype = eltype;
+  retval.shape.assign(PyArray_DIMS(array) + skip,
+      PyArray_DIMS(array) + PyArray_NDIM(array));
+  if (retval.shape.empty()) retval.shape.assign(2, 1);
+  return retval;
+}
+
+/**
+ * Returns the column-major index of the element at the row-major index k of
+ * an array with the given shape
+ */
+static size_t col_major_index (size_t k, const std::vector<size_t>& shape) {
+  size_t retval = 0;
+  size_t step = 1;
+  std::vector<size_t> index(shape.size());
+  for (size_t d=shape.size(); d>0; --d) {
+    index[d-1] = k % shape[d-1];
+    k /= shape[d-1];
+  }
+  for (size_t d=0; d<shape.size(); ++d) {
+    retval += index[d] * step;
+    step *= shape[d];
+  }
+  return retval;
+}
+
+/**
+ * Writes a dictionary (as a 1x1 struct) or a numpy structured array (as a
+ * struct array of the same shape)
+ */
+static PyObject* write_struct_object (const char* filename,
+    const char* varname, PyObject* data, const mat_options& options) {
+
+  std::vector<size_t> shape;
+  std::vector<std::string> fields;
+  std::vector<mat_type> types;
+  std::vector<const void*> ptrs;
+
+  // keeps the converted arrays alive while they are written
+  PyObject* arrays = PyList_New(0);
+  if (!arrays) return 0;
+  auto arrays_ = make_safe(arrays);
+
+  if (PyDict_Check(data)) {
+    shape.assign(2, 1);
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(data, &pos, &key, &value)) {
+      const char* name = as_string(key);
+      if (!name) return 0;
+      bob::io::base::array::ElementType eltype;
+      PyObject* array = field_array(value, eltype);
+      if (!array) return 0;
+      auto array_ = make_safe(array);
+      if (PyList_Append(arrays, array) < 0) return 0;
+      fields.push_back(name);
+      types.push_back(field_type((PyArrayObject*)array, eltype, 0));
+      ptrs.push_back(PyArray_DATA((PyArrayObject*)array));
+    }
+  }
+
+  else {
+    PyArrayObject* record = (PyArrayObject*)data;
+    size_t nd = PyArray_NDIM(record);
+    shape.assign(PyArray_DIMS(record), PyArray_DIMS(record) + nd);
+    if (shape.empty()) shape.assign(2, 1);
+    size_t elements = PyArray_SIZE(record);
+
+    PyObject* names = PyObject_GetAttrString((PyObject*)PyArray_DESCR(record), "names");
+    if (!names) return 0;
+    auto names_ = make_safe(names);
+    PyObject* seq = PySequence_Fast(names, "structured arrays should have field names");
+    if (!seq) return 0;
+    auto seq_ = make_safe(seq);
+
+    Py_ssize_t nfields = PySequence_Fast_GET_SIZE(seq);
+    types.resize(nfields * elements);
+    ptrs.resize(nfields * elements);
+    for (Py_ssize_t f=0; f<nfields; ++f) {
+      PyObject* item = PySequence_Fast_GET_ITEM(seq, f);
+      const char* name = as_string(item);
+      if (!name) return 0;
+      PyObject* view = PyObject_GetItem(data, item);
+      if (!view) return 0;
+      auto view_ = make_safe(view);
+      bob::io::base::array::ElementType eltype;
+      PyObject* array = field_array(view, eltype);
+      if (!array) return 0;
+      auto array_ = make_safe(array);
+      if (PyList_Append(arrays, array) < 0) return 0;
+      fields.push_back(name);
+
+      // each element has a (sub-)array of the field, which matio indexes
+      // in column-major order
+      mat_type type = field_type((PyArrayObject*)array, eltype, nd);
+      const char* base = static_cast<const char*>(PyArray_DATA((PyArrayObject*)array));
+      for (size_t k=0; k<elements; ++k) {
+        size_t j = f*elements + col_major_index(k, shape);
+        types[j] = type;
+        ptrs[j] = base + k*type.buffer_size();
+      }
+    }
+  }
+
+  try {
+    gil_release nogil;
+
+    auto matfile = make_matfile(filename, MAT_ACC_RDWR, options.version);
+    if (!matfile) {
+      boost::format m("Could not open the matlab file `%s' for writing");
+      m % filename;
+      throw std::runtime_error(m.str());
+    }
+    std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+
+    write_struct(matfile, varname, shape, fields, types, ptrs, options);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot write struct `%s' to matlab file `%s'", varname, filename);
+    return 0;
+  }
+
+  Py_RETURN_NONE;
+
+}
+
+/**
+ * Converts an index attribute (indices or indptr) of a sparse matrix to a
+ * contiguous 1D array of int32, as matio stores them, returning a new
+ * reference, or 0 with an error set. scipy switches to int64 indices for
+ * large matrices: these are converted if all values fit.
+ */
+template <typename T>
+static bool check_sparse_indices (const T* values, npy_intp size,
+    const char* name) {
+  for (npy_intp k=0; k<size; ++k) {
+    if (values[k] < 0 || values[k] > INT32_MAX) {
+      PyErr_Format(PyExc_ValueError, "sparse matrix %s should fit in 32-bit integers to be written to a matlab file, but %s[%zd] is %lld", name, name, k, (long long)values[k]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static PyObject* sparse_indices (PyObject* matrix, const char* name) {
+
+  PyObject* attr = PyObject_GetAttrString(matrix, name);
+  if (!attr) return 0;
+  auto attr_ = make_safe(attr);
+
+  PyObject* array = PyArray_FromAny(attr, 0, 1, 1, NPY_ARRAY_CARRAY_RO, 0);
+  if (!array) return 0;
+  auto array_ = make_safe(array);
+  if (PyArray_TYPE((PyArrayObject*)array) == NPY_INT32) {
+    if (!check_sparse_indices(static_cast<const int32_t*>(PyArray_DATA((PyArrayObject*)array)), PyArray_SIZE((PyArrayObject*)array), name)) return 0;
+    return Py_BuildValue("O", array);
+  }
+
+  if (!PyArray_ISINTEGER((PyArrayObject*)array)) {
+    PyErr_Format(PyExc_TypeError, "sparse matrix %s should be integers, not `%s'", name, PyBlitzArray_TypenumAsString(PyArray_TYPE((PyArrayObject*)array)));
+    return 0;
+  }
+
+  // unsigned values too large for int64 wrap around to negative ones
+  PyObject* wide = PyArray_FromAny(array, PyArray_DescrFromType(NPY_INT64),
+      1, 1, NPY_ARRAY_CARRAY_RO | NPY_ARRAY_FORCECAST, 0);
+  if (!wide) return 0;
+  auto wide_ = make_safe(wide);
+  if (!check_sparse_indices(static_cast<const npy_int64*>(PyArray_DATA((PyArrayObject*)wide)), PyArray_SIZE((PyArrayObject*)wide), name)) return 0;
+
+  return PyArray_FromAny(wide, PyArray_DescrFromType(NPY_INT32), 1, 1,
+      NPY_ARRAY_CARRAY_RO | NPY_ARRAY_FORCECAST, 0);
+
+}
+
+/**
+ * Writes a scipy sparse matrix, from its compressed sparse column (CSC)
+ * representation
+ */
+static PyObject* write_sparse_object (const char* filename,
+    const char* varname, PyObject* data, const mat_options& options) {
+
+  PyObject* csc = PyObject_CallMethod(data, const_cast<char*>("tocsc"), 0);
+  if (!csc) return 0;
+  auto csc_ = make_safe(csc);
+
+  // Matlab(R) expects row indices sorted within each column
+  PyObject* sorted = PyObject_GetAttrString(csc, "has_sorted_indices");
+  if (!sorted) return 0;
+  int is_sorted = PyObject_IsTrue(sorted);
+  Py_DECREF(sorted);
+  if (is_sorted < 0) return 0;
+  if (!is_sorted) {
+    PyObject* copy = PyObject_CallMethod(csc, const_cast<char*>("sorted_indices"), 0);
+    if (!copy) return 0;
+    csc_ = make_safe(copy);
+    csc = copy;
+  }
+
+  PyObject* shape = PyObject_GetAttrString(csc, "shape");
+  if (!shape) return 0;
+  auto shape_ = make_safe(shape);
+  Py_ssize_t rows, cols;
+  if (!PyArg_ParseTuple(shape, "nn", &rows, &cols)) return 0;
+  if (rows > INT32_MAX || cols > INT32_MAX) {
+    PyErr_Format(PyExc_ValueError, "sparse matrix should have at most %d rows and columns to be written to a matlab file, but has shape (%zd, %zd)", INT32_MAX, rows, cols);
+    return 0;
+  }
+
+  mat_sparse sparse;
+  sparse.rows = rows;
+  sparse.cols = cols;
+
+  PyObject* indices = sparse_indices(csc, "indices");
+  if (!indices) return 0;
+  auto indices_ = make_safe(indices);
+  PyObject* indptr = sparse_indices(csc, "indptr");
+  if (!indptr) return 0;
+  auto indptr_ = make_safe(indptr);
+
+  PyObject* values = PyObject_GetAttrString(csc, "data");
+  if (!values) return 0;
+  auto values_ = make_safe(values);
+  bool is_complex = PyArray_Check(values) &&
+    PyArray_ISCOMPLEX((PyArrayObject*)values);
+  PyObject* converted = PyArray_FromAny(values,
+      PyArray_DescrFromType(is_complex ? NPY_COMPLEX128 : NPY_FLOAT64), 1, 1,
+      NPY_ARRAY_CARRAY_RO, 0);
+  if (!converted) return 0;
+  auto converted_ = make_safe(converted);
+
+  if ((size_t)PyArray_SIZE((PyArrayObject*)indptr) != sparse.cols + 1) {
+    PyErr_Format(PyExc_ValueError, "sparse matrix has %zd column offsets, but should have %zd", (Py_ssize_t)PyArray_SIZE((PyArrayObject*)indptr), cols + 1);
+    return 0;
+  }
+  const int32_t* offsets = static_cast<const int32_t*>(PyArray_DATA((PyArrayObject*)indptr));
+  if (offsets[0] != 0) {
+    PyErr_Format(PyExc_ValueError, "sparse matrix column offsets should start at 0, not %d", offsets[0]);
+    return 0;
+  }
+  for (size_t k=0; k<sparse.cols; ++k) {
+    if (offsets[k+1] < offsets[k]) {
+      PyErr_Format(PyExc_ValueError, "sparse matrix column offsets should not decrease, but indptr[%zd] is %d and indptr[%zd] is %d", (Py_ssize_t)k, offsets[k], (Py_ssize_t)k+1, offsets[k+1]);
+      return 0;
+    }
+  }
+  sparse.nnz = offsets[sparse.cols];
+  if ((size_t)PyArray_SIZE((PyArrayObject*)indices) < sparse.nnz ||
+      (size_t)PyArray_SIZE((PyArrayObject*)converted) < sparse.nnz) {
+    PyErr_SetString(PyExc_ValueError, "sparse matrix has less row indices or values than non-zero elements");
+    return 0;
+  }
+  const int32_t* row_indices = static_cast<const int32_t*>(PyArray_DATA((PyArrayObject*)indices));
+  for (size_t k=0; k<sparse.nnz; ++k) {
+    if ((size_t)row_indices[k] >= sparse.rows) {
+      PyErr_Format(PyExc_ValueError, "sparse matrix has %zd rows, but its row index %zd is %d", rows, (Py_ssize_t)k, row_indices[k]);
+      return 0;
+    }
+  }
+
+  // the arrays are kept alive by the references above
+  sparse.dtype = is_complex ? bob::io::base::array::t_complex128 :
+    bob::io::base::array::t_float64;
+  sparse.indices = boost::shared_ptr<const int32_t>(boost::shared_ptr<void>(),
+      row_indices);
+  sparse.indptr = boost::shared_ptr<const int32_t>(boost::shared_ptr<void>(),
+      offsets);
+  sparse.data = boost::shared_ptr<const void>(boost::shared_ptr<void>(),
+      PyArray_DATA((PyArrayObject*)converted));
+
+  try {
+    gil_release nogil;
+
+    auto matfile = make_matfile(filename, MAT_ACC_RDWR, options.version);
+    if (!matfile) {
+      boost::format m("Could not open the matlab file `%s' for writing");
+      m % filename;
+      throw std::runtime_error(m.str());
+    }
+    std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+
+    write_sparse(matfile, varname, sparse, options);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot write sparse matrix `%s' to matlab file `%s'", varname, filename);
+    return 0;
+  }
+
+  Py_RETURN_NONE;
+
+}
+
+/**
+ * Tells if an object is a string, to be written as a char array
+ */
+static bool is_text (PyObject* o) {
+# if PY_VERSION_HEX >= 0x03000000
+  return PyUnicode_Check(o);
+# else
+  return PyUnicode_Check(o) || PyString_Check(o);
+# endif
+}
+
+/**
+ * Writes a string, or a sequence of strings, as a char array with one row
+ * per string. As in Matlab(R), shorter rows are padded with spaces.
+ */
+static PyObject* write_text_object (const char* filename,
+    const char* varname, PyObject* data, const mat_options& options) {
+
+  PyObject* seq = is_text(data) ? Py_BuildValue("(O)", data) :
+    PySequence_Fast(data, "char arrays are written from sequences of strings");
+  if (!seq) return 0;
+  auto seq_ = make_safe(seq);
+
+  // UTF-16 code units of each row, in the byte order of this machine
+  std::vector<std::vector<uint16_t> > units(PySequence_Fast_GET_SIZE(seq));
+  size_t cols = 0;
+  for (size_t k=0; k<units.size(); ++k) {
+    PyObject* item = PySequence_Fast_GET_ITEM(seq, k);
+    if (!is_text(item)) {
+      PyErr_SetString(PyExc_TypeError, "char arrays are written from sequences of strings");
+      return 0;
+    }
+    PyObject* unicode = PyUnicode_FromObject(item);
+    if (!unicode) return 0;
+    auto unicode_ = make_safe(unicode);
+    PyObject* encoded = PyUnicode_AsUTF16String(unicode);
+    if (!encoded) return 0;
+    auto encoded_ = make_safe(encoded);
+
+    // skips the byte order mark
+    const uint16_t* begin = reinterpret_cast<const uint16_t*>(PyBytes_AS_STRING(encoded)) + 1;
+    const uint16_t* end = begin + (PyBytes_GET_SIZE(encoded)/2 - 1);
+    units[k].assign(begin, end);
+    cols = std::max(cols, units[k].size());
+  }
+
+  std::vector<uint16_t> text(units.size() * cols, ' ');
+  for (size_t k=0; k<units.size(); ++k) {
+    std::copy(units[k].begin(), units[k].end(), text.begin() + k*cols);
+  }
+
+  try {
+    gil_release nogil;
+
+    auto matfile = make_matfile(filename, MAT_ACC_RDWR, options.version);
+    if (!matfile) {
+      boost::format m("Could not open the matlab file `%s' for writing");
+      m % filename;
+      throw std::runtime_error(m.str());
+    }
+    std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+
+    write_char(matfile, varname, text, units.size(), cols, options);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot write char array `%s' to matlab file `%s'", varname, filename);
+    return 0;
+  }
+
+  Py_RETURN_NONE;
+
+}
+
+PyDoc_STRVAR(s_write_matrix_str, "write_matrix");
+PyDoc_STRVAR(s_write_matrix_doc,
+"write_matrix(path, varname, array, [compression, [version, [chunk]]]) -> None\n\
+\n\
+Writes a matrix with the given varname to the given file.\n\
+\n\
+If the file already exists, the matrix is added to it, otherwise a new\n\
+file is created. It is an error to write a variable with a name that\n\
+already exists in the file.\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file to which you wish to write the matrix.\n\
+\n\
+varname, string\n\
+  The name of the variable that will hold the matrix\n\
+\n\
+array, array-like\n\
+  The data to write. It is converted to a numpy array of at least one\n\
+  dimension before writing. Arrays in column-major (Fortran) order are\n\
+  written as they are, without re-ordering, as that is the order used by\n\
+  Matlab(R). Dictionaries are written as (1x1) structs, with one field\n\
+  per key, and numpy structured arrays as struct arrays of the same\n\
+  shape, with one field per field of the array. All fields are written\n\
+  at once. scipy sparse matrices are written as sparse matrices, from\n\
+  their compressed sparse column (CSC) form, without densifying them.\n\
+  Strings, or lists of strings, are written as char arrays, with one row\n\
+  per string, padded with spaces. Boolean arrays are written as logical\n\
+  arrays.\n\
+\n\
+compression, bool (optional)\n\
+  If set, the matrix is compressed with zlib. matio does not let us choose\n\
+  the compression level. If not specified, the value returned by\n\
+  :py:func:`get_options` is used.\n\
+\n\
+version, string (optional)\n\
+  The format of the file, if it has to be created: ``'4'``, ``'5'`` or\n\
+  ``'7.3'`` (HDF5-based, needs matio compiled with HDF5 support). If not\n\
+  specified, the value returned by :py:func:`get_options` is used.\n\
+\n\
+chunk, int (optional)\n\
+  For version 7.3 files only: if set, the matrix is written by blocks of\n\
+  so many rows, each of which becomes one HDF5 chunk. If not specified, the\n\
+  value returned by :py:func:`get_options` is used. Arrays in column-major\n\
+  order are never chunked.\n\
+\n\
+");
+
+PyObject* PyBobIoMatlab_WriteMatrix(PyObject*, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", "varname", "array", "compression", "version", "chunk", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+  const char* varname;
+  PyObject* data;
+  PyObject* compression = 0;
+  const char* version = 0;
+  Py_ssize_t chunk = -1;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&sO|Osn", kwlist,
+        &PyBobIo_FilenameConverter, &filename, &varname, &data,
+        &compression, &version, &chunk)) return 0;
+
+  mat_options options = default_options();
+  if (!update_options(options, compression, version, chunk)) return 0;
+
+  if (PyDict_Check(data) || (PyArray_Check(data) &&
+        PyDataType_HASFIELDS(PyArray_DESCR((PyArrayObject*)data)))) {
+    return write_struct_object(filename, varname, data, options);
+  }
+
+  if (is_text(data) || ((PyList_Check(data) || PyTuple_Check(data)) &&
+        PySequence_Fast_GET_SIZE(data) > 0 && is_text(PySequence_Fast_GET_ITEM(data, 0)))) {
+    return write_text_object(filename, varname, data, options);
+  }
+
+  if (!PyArray_Check(data) && PyObject_HasAttrString(data, "tocsc")) {
+    return write_sparse_object(filename, varname, data, options);
+  }
+
+  // Fortran-ordered arrays are written as they are, without re-ordering
+  bool col_major = PyArray_Check(data) &&
+    PyArray_ISFARRAY_RO((PyArrayObject*)data) &&
+    !PyArray_ISCARRAY_RO((PyArrayObject*)data);
+
+  PyObject* array = PyArray_FromAny(data, 0, 1, NPY_MAXDIMS,
+      col_major ? NPY_ARRAY_FARRAY_RO : NPY_ARRAY_CARRAY_RO, 0);
+  if (!array) return 0;
+  auto array_ = make_safe(array);
+
+  bob::io::base::array::ElementType eltype = element_type((PyArrayObject*)array);
+  if (eltype == bob::io::base::array::t_unknown) {
+    PyErr_Format(PyExc_TypeError, "cannot write arrays of type `%s' to matlab files", PyBlitzArray_TypenumAsString(PyArray_TYPE((PyArrayObject*)array)));
+    return 0;
+  }
+
+  mat_type type;
+  type.dtype = eltype;
+  type.shape.assign(PyArray_DIMS((PyArrayObject*)array),
+      PyArray_DIMS((PyArrayObject*)array) + PyArray_NDIM((PyArrayObject*)array));
+  const void* ptr = PyArray_DATA((PyArrayObject*)array);
+
+  try {
+    gil_release nogil;
+
+    // open (or create) matlab file
+    auto matfile = make_matfile(filename, MAT_ACC_RDWR, options.version);
+    if (!matfile) {
+      boost::format m("Could not open the matlab file `%s' for writing");
+      m % filename;
+      throw std::runtime_error(m.str());
+    }
+    std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+
+    //arrays with more dimensions than a typeinfo can hold are written as a
+    //whole, never chunked
+    if (type.shape.size() <= BOB_MAX_DIM) {
+      bob::io::base::array::typeinfo info(eltype, type.shape.size(), &type.shape[0]);
+      array_buffer view(const_cast<void*>(ptr), info);
+      write_array(matfile, varname, view, options, col_major);
+    }
+    else write_array(matfile, varname, type, ptr, options, col_major);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot write variable `%s' to matlab file `%s'", varname, filename);
+    return 0;
+  }
+
+  Py_RETURN_NONE;
+
+}
+
+PyDoc_STRVAR(s_read_struct_str, "read_struct");
+PyDoc_STRVAR(s_read_struct_doc,
+"read_struct(path, varname, [fields]) -> dict\n\
+\n\
+Reads the fields of the matlab struct with the given varname from the\n\
+given file.\n\
+\n\
+Only the fields asked for are decoded. For a (1x1) struct, returns a\n\
+dictionary with the array of each field. For struct arrays, the\n\
+dictionary holds, for each field, a numpy array of objects with the\n\
+shape of the struct array, holding the array of the field for each\n\
+element. Fields that are not numeric arrays are returned as ``None``.\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file from which you wish to read the struct.\n\
+\n\
+varname, string\n\
+  The name of the struct variable, one of the values returned by\n\
+  :py:func:`read_varnames`\n\
+\n\
+fields, sequence of strings (optional)\n\
+  The names of the fields to read. If not specified, all fields are read.\n\
+\n\
+");
+
+/**
+ * Reads the value of a field of the element at index of a struct, or
+ * returns None if it is not a numeric array
+ */
+static PyObject* read_field (mat_struct_reader& reader,
+    const std::string& field, size_t index) {
 
-PyDoc_STRVAR(s_read_varnames_str, "read_varnames");
-PyDoc_STRVAR(s_read_varnames_doc,
-"read_varnames(path) -> list\n\
-\n\
-Returns the list of variable names stored in the given Matlab(R) file.\n\
-"
-);
+  mat_type type;
+  reader.type(field, index, type);
+  if (type.dtype == bob::io::base::array::t_unknown) Py_RETURN_NONE;
 
-PyObject* PyBobIoMatlab_ReadVarNames(PyObject*, PyObject* o) {
+  npy_intp shape[NPY_MAXDIMS];
+  if (!numpy_shape(type, shape)) return 0;
 
-  const char* filename;
+  int type_num = PyBobIo_AsTypenum(type.dtype);
+  if (type_num == NPY_NOTYPE) return 0; ///< failure
 
-  if (!PyBobIo_FilenameConverter(o, &filename)) return 0;
+  PyObject* retval = PyArray_SimpleNew(type.shape.size(), shape, type_num);
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  {
+    void* data = PyArray_DATA((PyArrayObject*)retval);
+    gil_release nogil;
+    reader.read(field, index, type, data);
+  }
+
+  return Py_BuildValue("O", retval);
+
+}
+
+PyObject* PyBobIoMatlab_StructAsPython (mat_struct_reader& reader,
+    const std::vector<std::string>& fields) {
 
-  auto list = list_variables(filename);
-  PyObject* retval = PyTuple_New(list->size());
+  PyObject* retval = PyDict_New();
   if (!retval) return 0;
   auto retval_ = make_safe(retval);
 
-  int k = 0;
-  for (auto it = list->begin(); it != list->end(); ++it, ++k) {
-    PyObject* item = Py_BuildValue("s", it->second.first.c_str());
-    if (!item) return 0;
-    PyTuple_SET_ITEM(retval, k, item);
+  mat_type struct_type;
+  struct_type.shape = reader.shape();
+  npy_intp shape[NPY_MAXDIMS];
+  if (!numpy_shape(struct_type, shape)) return 0;
+
+  for (size_t f=0; f<fields.size(); ++f) {
+    PyObject* value = 0;
+
+    if (reader.size() == 1) {
+      value = read_field(reader, fields[f], 0);
+      if (!value) return 0;
+    }
+
+    else {
+      // matio indexes elements in column-major order
+      value = PyArray_New(&PyArray_Type, struct_type.shape.size(), shape,
+          NPY_OBJECT, 0, 0, 0, NPY_ARRAY_F_CONTIGUOUS, 0);
+      if (!value) return 0;
+      auto value_ = make_safe(value);
+      PyObject** items = static_cast<PyObject**>(PyArray_DATA((PyArrayObject*)value));
+      for (size_t k=0; k<reader.size(); ++k) {
+        PyObject* item = read_field(reader, fields[f], k);
+        if (!item) return 0;
+        Py_XDECREF(items[k]);
+        items[k] = item;
+      }
+      Py_INCREF(value);
+    }
+
+    auto value_ = make_safe(value);
+    if (PyDict_SetItemString(retval, fields[f].c_str(), value) < 0) return 0;
   }
 
   return Py_BuildValue("O", retval);
 
 }
 
-PyDoc_STRVAR(s_read_matrix_str, "read_matrix");
-PyDoc_STRVAR(s_read_matrix_doc,
-"read_matrix(path, [varname]) -> array\n\
+PyObject* PyBobIoMatlab_ReadStruct(PyObject*, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", "varname", "fields", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+  const char* varname;
+  PyObject* fields_object = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&s|O", kwlist,
+        &PyBobIo_FilenameConverter, &filename, &varname, &fields_object)) return 0;
+
+  try {
+    boost::shared_ptr<mat_t> matfile;
+    boost::shared_ptr<matvar_t> header;
+    boost::shared_ptr<mat_struct_reader> reader;
+
+    {
+      gil_release nogil;
+      matfile = make_matfile(filename, MAT_ACC_RDONLY);
+      std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+      if (matfile) header = read_header(matfile, varname);
+      if (header) reader = boost::make_shared<mat_struct_reader>(matfile, header);
+    }
+
+    if (!matfile) {
+      PyErr_Format(PyExc_RuntimeError,
+          "Could open the matlab file `%s'", filename);
+      return 0;
+    }
+
+    if (!header) {
+      PyErr_Format(PyExc_RuntimeError, "Cannot locate variable `%s' in file '%s'", varname, filename);
+      return 0;
+    }
+
+    std::vector<std::string> fields;
+    if (fields_object && fields_object != Py_None) {
+      PyObject* seq = PySequence_Fast(fields_object, "fields should be a sequence of strings");
+      if (!seq) return 0;
+      auto seq_ = make_safe(seq);
+      for (Py_ssize_t k=0; k<PySequence_Fast_GET_SIZE(seq); ++k) {
+        const char* name = as_string(PySequence_Fast_GET_ITEM(seq, k));
+        if (!name) return 0;
+        if (std::find(reader->fields().begin(), reader->fields().end(), name) == reader->fields().end()) {
+          PyErr_Format(PyExc_KeyError, "struct `%s' has no field `%s'", varname, name);
+          return 0;
+        }
+        fields.push_back(name);
+      }
+    }
+    else fields = reader->fields();
+
+    return PyBobIoMatlab_StructAsPython(*reader, fields);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read struct `%s' from matlab file `%s'", varname, filename);
+    return 0;
+  }
+
+}
+
+PyDoc_STRVAR(s_read_sparse_str, "read_sparse");
+PyDoc_STRVAR(s_read_sparse_doc,
+"read_sparse(path, varname) -> scipy.sparse.csc_matrix\n\
 \n\
-Reads the matlab matrix with the given varname from the given file.\n\
+Reads the sparse matrix with the given varname from the given file.\n\
+\n\
+The matrix is returned in compressed sparse column (CSC) format, which is\n\
+the one used by Matlab(R): the row indices and values of the non-zero\n\
+elements are those decoded by matio, and the matrix is never expanded to\n\
+its dense form. If scipy is not available, returns a tuple ``(data,\n\
+indices, indptr, shape)`` instead, with the same meaning as the\n\
+attributes of :py:class:`scipy.sparse.csc_matrix`.\n\
 \n\
 Keyword arguments:\n\
 \n\
 path, string\n\
   A string containing the path (relative or absolute) to the Matlab(R)\n\
-  file from which you wisht to read the matrix from.\n\
+  file from which you wish to read the matrix.\n\
 \n\
-varname, string (optional)\n\
-  If this parameter is not specified, the first matrix will be returned.\n\
-  Otherwise, specify here one of the values returned by\n\
-  :py:func:`read_varnames`\n\
+varname, string\n\
+  One of the values returned by :py:func:`read_varnames`\n\
 \n\
 ");
 
-PyObject* PyBobIoMatlab_ReadMatrix(PyObject*, PyObject* args, PyObject* kwds) {
+/**
+ * Creates a 1D numpy array of size elements, which refers to data without
+ * copying it and keeps it alive
+ */
+static PyObject* adopt_vector (boost::shared_ptr<const void> data,
+    size_t size, int type_num) {
+
+  npy_intp shape = size;
+  if (!size) return PyArray_SimpleNew(1, &shape, type_num);
+
+  PyObject* retval = PyArray_New(&PyArray_Type, 1, &shape, type_num, 0,
+      const_cast<void*>(data.get()), 0, NPY_ARRAY_CARRAY, 0);
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  if (!set_owner(retval, data)) return 0;
+
+  return Py_BuildValue("O", retval);
+
+}
+
+PyObject* PyBobIoMatlab_SparseAsPython (const mat_sparse& sparse) {
+
+  PyObject* data = adopt_vector(sparse.data, sparse.nnz,
+      PyBobIo_AsTypenum(sparse.dtype));
+  if (!data) return 0;
+  auto data_ = make_safe(data);
+  PyObject* indices = adopt_vector(sparse.indices, sparse.nnz, NPY_INT32);
+  if (!indices) return 0;
+  auto indices_ = make_safe(indices);
+  PyObject* indptr = adopt_vector(sparse.indptr, sparse.cols + 1, NPY_INT32);
+  if (!indptr) return 0;
+  auto indptr_ = make_safe(indptr);
+
+  PyObject* retval = Py_BuildValue("OOO(nn)", data, indices, indptr,
+      sparse.rows, sparse.cols);
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  // scipy is optional
+  PyObject* module = PyImport_ImportModule("scipy.sparse");
+  if (!module) {
+    if (!PyErr_ExceptionMatches(PyExc_ImportError)) return 0;
+    PyErr_Clear();
+    return Py_BuildValue("O", retval);
+  }
+  auto module_ = make_safe(module);
+
+  PyObject* csc = PyObject_GetAttrString(module, "csc_matrix");
+  if (!csc) return 0;
+  auto csc_ = make_safe(csc);
+
+  return PyObject_CallFunction(csc, const_cast<char*>("(OOO)(nn)"), data,
+      indices, indptr, sparse.rows, sparse.cols);
+
+}
+
+PyObject* PyBobIoMatlab_ReadSparse(PyObject*, PyObject* args, PyObject* kwds) {
 
   /* Parses input arguments in a single shot */
   static const char* const_kwlist[] = {"path", "varname", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   const char* filename;
-  const char* varname = 0;
+  const char* varname;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|s", kwlist,
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&s", kwlist,
         &PyBobIo_FilenameConverter, &filename, &varname)) return 0;
 
-  // open matlab file
-  auto matfile = make_matfile(filename, MAT_ACC_RDONLY);
+  mat_sparse sparse;
 
-  if (!matfile) {
-    PyErr_Format(PyExc_RuntimeError,
-        "Could open the matlab file `%s'", filename);
+  try {
+    gil_release nogil;
+
+    boost::shared_ptr<mat_t> matfile = make_matfile(filename, MAT_ACC_RDONLY);
+    if (!matfile) {
+      boost::format m("Could open the matlab file `%s'");
+      m % filename;
+      throw std::runtime_error(m.str());
+    }
+    std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(matfile.get()));
+
+    boost::shared_ptr<matvar_t> header = read_header(matfile, varname);
+    if (!header) {
+      boost::format m("Cannot locate variable `%s' in file '%s'");
+      m % varname % filename;
+      throw std::runtime_error(m.str());
+    }
+
+    read_sparse(matfile, header, sparse);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot read sparse matrix `%s' from matlab file `%s'", varname, filename);
     return 0;
   }
 
+  return PyBobIoMatlab_SparseAsPython(sparse);
+
+}
+
+PyDoc_STRVAR(s_append_many_str, "append_many");
+PyDoc_STRVAR(s_append_many_doc,
+"append_many(path, arrays) -> int\n\
+\n\
+Appends all arrays to the given file, as :py:meth:`bob.io.base.File.append`\n\
+would, but opening and closing the file only once.\n\
+\n\
+The arrays are stored in variables named after their index in the file\n\
+(``array_0``, ``array_1``, ...), and must all have the same type and\n\
+shape as the arrays already in the file. The file is created if it does\n\
+not exist, using the options returned by :py:func:`get_options`. Returns\n\
+the index of the first appended array.\n\
+\n\
+Keyword arguments:\n\
+\n\
+path, string\n\
+  A string containing the path (relative or absolute) to the Matlab(R)\n\
+  file to which you wish to append the arrays.\n\
+\n\
+arrays, sequence of array-like\n\
+  The arrays to append. Each one is converted to a numpy array of 1 to 4\n\
+  dimensions before writing.\n\
+\n\
+");
+
+PyObject* PyBobIoMatlab_AppendMany(PyObject*, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"path", "arrays", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* filename;
+  PyObject* arrays_object;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O", kwlist,
+        &PyBobIo_FilenameConverter, &filename, &arrays_object)) return 0;
+
+  PyObject* seq = PySequence_Fast(arrays_object, "arrays should be a sequence of array-like objects");
+  if (!seq) return 0;
+  auto seq_ = make_safe(seq);
+
+  // keeps the converted arrays alive while their skins are used
+  Py_ssize_t length = PySequence_Fast_GET_SIZE(seq);
+  PyObject* arrays = PyTuple_New(length);
+  if (!arrays) return 0;
+  auto arrays_ = make_safe(arrays);
+
+  std::vector<boost::shared_ptr<bobskin> > skins;
+  std::vector<const bob::io::base::array::interface*> buffers;
+  skins.reserve(length);
+  buffers.reserve(length);
+
+  for (Py_ssize_t k=0; k<length; ++k) {
+    PyObject* array = PyArray_FromAny(PySequence_Fast_GET_ITEM(seq, k), 0, 1,
+        BOB_MAX_DIM, NPY_ARRAY_CARRAY_RO, 0);
+    if (!array) return 0;
+    PyTuple_SET_ITEM(arrays, k, array);
+
+    bob::io::base::array::ElementType eltype = element_type((PyArrayObject*)array);
+    if (eltype == bob::io::base::array::t_unknown) {
+      PyErr_Format(PyExc_TypeError, "cannot write arrays of type `%s' to matlab files", PyBlitzArray_TypenumAsString(PyArray_TYPE((PyArrayObject*)array)));
+      return 0;
+    }
+
+    skins.push_back(boost::make_shared<bobskin>((PyArrayObject*)array, eltype));
+    buffers.push_back(skins.back().get());
+  }
+
   try {
-    // get type of data
-    bob::io::base::array::typeinfo info;
-    mat_peek(filename, info, varname);
+    auto file = make_file(filename, 'a');
+    size_t first = append_many(*file, buffers);
+    flush(*file);
+    return Py_BuildValue("n", (Py_ssize_t)first);
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot append arrays to matlab file `%s'", filename);
+    return 0;
+  }
 
-    npy_intp shape[NPY_MAXDIMS];
-    for (size_t k=0; k<info.nd; ++k) shape[k] = info.shape[k];
+}
 
-    int type_num = PyBobIo_AsTypenum(info.dtype);
-    if (type_num == NPY_NOTYPE) return 0; ///< failure
+PyDoc_STRVAR(s_read_many_str, "read_many");
+PyDoc_STRVAR(s_read_many_doc,
+"read_many(requests, [num_threads, [out]]) -> list or array\n\
+\n\
+Reads many matrices, from one or many Matlab(R) files, concurrently.\n\
+\n\
+The files are read on a pool of threads and without holding the\n\
+Python global interpreter lock, which pays off when reading many small\n\
+files. Version 7.3 (HDF5-based) files are read one at a time, as the\n\
+HDF5 library is not thread-safe.\n\
+\n\
+Keyword arguments:\n\
+\n\
+requests, sequence\n\
+  A sequence of ``(path, varname)`` tuples, giving the file and the name\n\
+  of each matrix to read\n\
+\n\
+num_threads, int (optional)\n\
+  The number of threads to use. If not specified (or zero), uses as many\n\
+  threads as there are processors.\n\
+\n\
+out, array (optional)\n\
+  If given, a C-contiguous array whose first dimension matches the number\n\
+  of requests. Each matrix is read directly into ``out[k]``, and must have\n\
+  the same type and shape. Otherwise, a list of newly allocated arrays is\n\
+  returned.\n\
+\n\
+");
 
-    PyObject* retval = PyArray_SimpleNew(info.nd, shape, type_num);
-    if (!retval) return 0;
-    auto retval_ = make_safe(retval);
+PyObject* PyBobIoMatlab_ReadMany(PyObject*, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"requests", "num_threads", "out", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
 
-    bobskin skin((PyArrayObject*)retval, info.dtype);
-    read_array(matfile, skin, varname);
+  PyObject* requests_object;
+  Py_ssize_t num_threads = 0;
+  PyObject* out = 0;
 
-    return Py_BuildValue("O", retval);
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nO", kwlist,
+        &requests_object, &num_threads, &out)) return 0;
+
+  if (num_threads < 0) {
+    PyErr_SetString(PyExc_ValueError, "the number of threads cannot be negative");
+    return 0;
+  }
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  PyObject* seq = PySequence_Fast(requests_object, "requests should be a sequence of (path, varname) tuples");
+  if (!seq) return 0;
+  auto seq_ = make_safe(seq);
+
+  std::vector<mat_request> requests(PySequence_Fast_GET_SIZE(seq));
+  for (size_t k=0; k<requests.size(); ++k) {
+    const char* filename;
+    const char* varname;
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, k), "O&s",
+          &PyBobIo_FilenameConverter, &filename, &varname)) return 0;
+    requests[k].path = filename;
+    requests[k].varname = varname;
+  }
+
+  // one buffer for each request, either new or within out
+  std::vector<boost::shared_ptr<bob::io::base::array::interface> > bufs;
+  bufs.reserve(requests.size());
+
+  if (out && out != Py_None) {
+
+    if (!PyArray_Check(out)) {
+      PyErr_Format(PyExc_TypeError, "`out' should be a numpy array, not `%s'", Py_TYPE(out)->tp_name);
+      return 0;
+    }
+
+    PyArrayObject* out_ = (PyArrayObject*)out;
+    if (!PyArray_IS_C_CONTIGUOUS(out_) || !PyArray_ISWRITEABLE(out_)) {
+      PyErr_SetString(PyExc_ValueError, "`out' should be a C-contiguous and writeable array");
+      return 0;
+    }
+
+    if (PyArray_NDIM(out_) < 2 || PyArray_NDIM(out_) > (BOB_MAX_DIM+1) ||
+        (size_t)PyArray_DIM(out_, 0) != requests.size()) {
+      PyErr_Format(PyExc_ValueError, "`out' should have between 2 and %d dimensions, the first one matching the number of requests (%zu)", BOB_MAX_DIM+1, requests.size());
+      return 0;
+    }
+
+    bob::io::base::array::ElementType eltype = element_type(out_);
+    if (eltype == bob::io::base::array::t_unknown) {
+      PyErr_Format(PyExc_TypeError, "cannot read matlab arrays into arrays of type `%s'", PyBlitzArray_TypenumAsString(PyArray_TYPE(out_)));
+      return 0;
+    }
+
+    size_t shape[BOB_MAX_DIM];
+    for (int k=1; k<PyArray_NDIM(out_); ++k) shape[k-1] = PyArray_DIM(out_, k);
+    bob::io::base::array::typeinfo info(eltype, (size_t)(PyArray_NDIM(out_)-1), shape);
+
+    for (size_t k=0; k<requests.size(); ++k) {
+      void* ptr = PyArray_BYTES(out_) + k*PyArray_STRIDE(out_, 0);
+      bufs.push_back(boost::make_shared<array_buffer>(ptr, info));
+    }
+
+  }
+
+  else {
+    for (size_t k=0; k<requests.size(); ++k)
+      bufs.push_back(boost::make_shared<array_buffer>());
+  }
+
+  std::vector<std::string> errors;
+
+  try {
+    gil_release nogil;
+    read_many(requests, bufs, errors, num_threads);
   }
   catch (std::exception& e) {
     PyErr_SetString(PyExc_RuntimeError, e.what());
     return 0;
   }
   catch (...) {
-    PyErr_Format(PyExc_RuntimeError, "cannot read contents of variable `%s' at matlab file `%s'", varname, filename);
+    PyErr_SetString(PyExc_RuntimeError, "cannot read variables from matlab files: unknown error");
     return 0;
   }
 
+  for (size_t k=0; k<errors.size(); ++k) {
+    if (!errors[k].empty()) {
+      PyErr_Format(PyExc_RuntimeError, "cannot read variable `%s' from matlab file `%s': %s", requests[k].varname.c_str(), requests[k].path.c_str(), errors[k].c_str());
+      return 0;
+    }
+  }
+
+  if (out && out != Py_None) return Py_BuildValue("O", out);
+
+  PyObject* retval = PyList_New(bufs.size());
+  if (!retval) return 0;
+  auto retval_ = make_safe(retval);
+
+  for (size_t k=0; k<bufs.size(); ++k) {
+    PyObject* array = PyBobIoMatlab_BufferAsPython(*bufs[k]);
+    if (!array) return 0;
+    PyList_SET_ITEM(retval, k, array);
+  }
+
+  return Py_BuildValue("O", retval);
+
+}
+
+PyDoc_STRVAR(s_set_options_str, "set_options");
+PyDoc_STRVAR(s_set_options_doc,
+"set_options([compression, [version, [chunk, [threads]]]]) -> None\n\
+\n\
+Sets the options used to read and write Matlab(R) files through\n\
+:py:func:`bob.io.base.save` and :py:class:`bob.io.base.File`. Files that\n\
+are already open keep the options they were opened with. Options that\n\
+are not specified are left untouched.\n\
+\n\
+Keyword arguments:\n\
+\n\
+compression, bool (optional)\n\
+  If set, variables are compressed with zlib\n\
+\n\
+version, string (optional)\n\
+  The format of new files: ``'4'``, ``'5'`` or ``'7.3'``. Set it to\n\
+  ``None`` to go back to matio's default.\n\
+\n\
+chunk, int (optional)\n\
+  For version 7.3 files only: if non-zero, arrays are written by blocks of\n\
+  so many rows, each of which becomes one HDF5 chunk\n\
+\n\
+threads, int (optional)\n\
+  The number of threads used to convert large arrays between the\n\
+  row-major order of numpy and the column-major order of Matlab(R).\n\
+  This is also used by :py:func:`read_matrix` and\n\
+  :py:func:`write_matrix`. Decompression is done by matio and always\n\
+  happens on a single thread. The default is 1 (no threading).\n\
+\n\
+");
+
+PyObject* PyBobIoMatlab_SetOptions(PyObject*, PyObject* args, PyObject* kwds) {
+
+  /* Parses input arguments in a single shot */
+  static const char* const_kwlist[] = {"compression", "version", "chunk", "threads", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  PyObject* compression = 0;
+  PyObject* version_object = 0;
+  Py_ssize_t chunk = -1;
+  Py_ssize_t threads = -1;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOnn", kwlist,
+        &compression, &version_object, &chunk, &threads)) return 0;
+
+  mat_options options = default_options();
+
+  //None goes back to matio's default version
+  const char* version = 0;
+  if (version_object == Py_None) options.version = 0;
+  else if (version_object && !PyArg_Parse(version_object, "s", &version)) return 0;
+
+  if (!update_options(options, compression, version, chunk, threads)) return 0;
+
+  default_options() = options;
+
+  Py_RETURN_NONE;
+
+}
+
+PyDoc_STRVAR(s_get_options_str, "get_options");
+PyDoc_STRVAR(s_get_options_doc,
+"get_options() -> dict\n\
+\n\
+Returns the options currently used to read and write Matlab(R) files through\n\
+:py:mod:`bob.io.base`. See :py:func:`set_options`.\n\
+");
+
+PyObject* PyBobIoMatlab_GetOptions(PyObject*) {
+
+  const mat_options& options = default_options();
+
+  return Py_BuildValue("{s:O,s:z,s:n,s:n}",
+      "compression", options.compress ? Py_True : Py_False,
+      "version", version_name(options.version),
+      "chunk", (Py_ssize_t)options.chunk,
+      "threads", (Py_ssize_t)options.threads);
+
 }
 
 static PyMethodDef module_methods[] = {
@@ -126,12 +1837,66 @@ static PyMethodDef module_methods[] = {
     METH_O,
     s_read_varnames_doc,
   },
+  {
+    s_read_vartypes_str,
+    (PyCFunction)PyBobIoMatlab_ReadVarTypes,
+    METH_O,
+    s_read_vartypes_doc,
+  },
   {
     s_read_matrix_str,
     (PyCFunction)PyBobIoMatlab_ReadMatrix,
     METH_VARARGS|METH_KEYWORDS,
     s_read_matrix_doc,
   },
+  {
+    s_read_slice_str,
+    (PyCFunction)PyBobIoMatlab_ReadSlice,
+    METH_VARARGS|METH_KEYWORDS,
+    s_read_slice_doc,
+  },
+  {
+    s_read_struct_str,
+    (PyCFunction)PyBobIoMatlab_ReadStruct,
+    METH_VARARGS|METH_KEYWORDS,
+    s_read_struct_doc,
+  },
+  {
+    s_read_sparse_str,
+    (PyCFunction)PyBobIoMatlab_ReadSparse,
+    METH_VARARGS|METH_KEYWORDS,
+    s_read_sparse_doc,
+  },
+  {
+    s_append_many_str,
+    (PyCFunction)PyBobIoMatlab_AppendMany,
+    METH_VARARGS|METH_KEYWORDS,
+    s_append_many_doc,
+  },
+  {
+    s_read_many_str,
+    (PyCFunction)PyBobIoMatlab_ReadMany,
+    METH_VARARGS|METH_KEYWORDS,
+    s_read_many_doc,
+  },
+  {
+    s_write_matrix_str,
+    (PyCFunction)PyBobIoMatlab_WriteMatrix,
+    METH_VARARGS|METH_KEYWORDS,
+    s_write_matrix_doc,
+  },
+  {
+    s_set_options_str,
+    (PyCFunction)PyBobIoMatlab_SetOptions,
+    METH_VARARGS|METH_KEYWORDS,
+    s_set_options_doc,
+  },
+  {
+    s_get_options_str,
+    (PyCFunction)PyBobIoMatlab_GetOptions,
+    METH_NOARGS,
+    s_get_options_doc,
+  },
   {0}  /* Sentinel */
 };
 
@@ -150,6 +1915,10 @@ static PyModuleDef module_definition = {
 
 static PyObject* create_module (void) {
 
+  if (PyType_Ready(&PyBobIoMatlabBlockReader_Type) < 0) return 0;
+  if (PyType_Ready(&PyBobIoMatlabCellArray_Type) < 0) return 0;
+  if (PyType_Ready(&PyBobIoMatlabMatArchive_Type) < 0) return 0;
+
 # if PY_VERSION_HEX >= 0x03000000
   PyObject* m = PyModule_Create(&module_definition);
   auto m_ = make_xsafe(m);
@@ -160,6 +1929,16 @@ static PyObject* create_module (void) {
 # endif
   if (!m) return 0;
 
+  /* register the types to python */
+  Py_INCREF(&PyBobIoMatlabBlockReader_Type);
+  if (PyModule_AddObject(m, "BlockReader", (PyObject *)&PyBobIoMatlabBlockReader_Type) < 0) return 0;
+
+  Py_INCREF(&PyBobIoMatlabCellArray_Type);
+  if (PyModule_AddObject(m, "CellArray", (PyObject *)&PyBobIoMatlabCellArray_Type) < 0) return 0;
+
+  Py_INCREF(&PyBobIoMatlabMatArchive_Type);
+  if (PyModule_AddObject(m, "MatArchive", (PyObject *)&PyBobIoMatlabMatArchive_Type) < 0) return 0;
+
   /* imports dependencies */
   if (import_bob_blitz() < 0) return 0;
   if (import_bob_core_logging() < 0) return 0;
@@ -0,0 +1,83 @@
+/**
+ * @date Fri 16 Oct 15:39:53 2026 UTC
+ *
+ * @brief Declarations of the Python types defined in this extension
+ */
+
+#ifndef PYTHON_BOB_IO_MATLAB_MAIN_H
+#define PYTHON_BOB_IO_MATLAB_MAIN_H
+
+#include <Python.h>
+#include <boost/shared_ptr.hpp>
+
+#include "utils.h"
+
+/**
+ * Iterates over a matlab variable by blocks of rows
+ */
+typedef struct {
+  PyObject_HEAD
+  boost::shared_ptr<mat_block_reader> cxx;
+} PyBobIoMatlabBlockReaderObject;
+
+extern PyTypeObject PyBobIoMatlabBlockReader_Type;
+
+/**
+ * Reads the elements of a matlab cell array as they are indexed
+ */
+typedef struct {
+  PyObject_HEAD
+  boost::shared_ptr<mat_cell_reader> cxx;
+} PyBobIoMatlabCellArrayObject;
+
+extern PyTypeObject PyBobIoMatlabCellArray_Type;
+
+/**
+ * Opens a matlab file once, and reads its variables by name
+ */
+typedef struct {
+  PyObject_HEAD
+  boost::shared_ptr<mat_archive> cxx;
+} PyBobIoMatlabMatArchiveObject;
+
+extern PyTypeObject PyBobIoMatlabMatArchive_Type;
+
+/**
+ * Checks the object was initialized, which may not be the case if __new__()
+ * was called without __init__(), setting a RuntimeError otherwise
+ */
+template <typename T> bool PyBobIoMatlab_CheckInitialized(T* self) {
+  if (self->cxx) return true;
+  PyErr_Format(PyExc_RuntimeError, "%s object was not initialized",
+      Py_TYPE(self)->tp_name);
+  return false;
+}
+
+/**
+ * Creates a numpy array that uses the memory of buf without copying it. The
+ * array keeps buf's memory alive.
+ */
+PyObject* PyBobIoMatlab_BufferAsPython(bob::io::base::array::interface& buf);
+
+/**
+ * Converts the rows of a char array, read with read_char(), to a string for
+ * a single row, or a list with one string per row
+ */
+PyObject* PyBobIoMatlab_TextAsPython(const std::vector<uint16_t>& text,
+    size_t rows, size_t cols);
+
+/**
+ * Converts a sparse matrix to a scipy.sparse.csc_matrix, or to a tuple
+ * (data, indices, indptr, shape) if scipy is not available, without
+ * copying it
+ */
+PyObject* PyBobIoMatlab_SparseAsPython(const mat_sparse& sparse);
+
+/**
+ * Reads the given fields of a struct into a dictionary, see read_struct().
+ * Throws on errors reading the file.
+ */
+PyObject* PyBobIoMatlab_StructAsPython(mat_struct_reader& reader,
+    const std::vector<std::string>& fields);
+
+#endif /* PYTHON_BOB_IO_MATLAB_MAIN_H */
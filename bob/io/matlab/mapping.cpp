@@ -0,0 +1,257 @@
+/**
+ * @date Fri 16 Oct 15:58:44 2026 UTC
+ *
+ * @brief Zero-copy access to the data of uncompressed variables in version 5
+ * .mat files.
+ *
+ * matio always reads variable data into buffers of its own. Here, the file
+ * is walked through directly, following the version 5 format: a 128 byte
+ * header, followed by one data element per variable. Each element starts
+ * with a tag giving its type and size in bytes. Uncompressed variables are
+ * miMATRIX elements, made of sub-elements for the array flags, dimensions,
+ * name and, last, the (column-major) data. Once the offset of the data is
+ * known, that region of the file is mapped to memory, read-only.
+ *
+ * Version 7.3 files are HDF5 files: the offset of a contiguous dataset is
+ * only known to HDF5 itself, which matio does not expose, so those are not
+ * mapped.
+ */
+
+#include "mapping.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Data types of elements, as defined by the version 5 format
+ */
+enum {
+  miINT8 = 1,
+  miUINT8 = 2,
+  miINT16 = 3,
+  miUINT16 = 4,
+  miINT32 = 5,
+  miUINT32 = 6,
+  miSINGLE = 7,
+  miDOUBLE = 9,
+  miINT64 = 12,
+  miUINT64 = 13,
+  miMATRIX = 14,
+  miCOMPRESSED = 15
+};
+
+/**
+ * Array flags, on the second byte of the first word of the flags
+ * sub-element
+ */
+static const uint32_t COMPLEX_FLAG = 0x0800;
+static const uint32_t LOGICAL_FLAG = 0x0200;
+
+/**
+ * Returns the element data type a numeric array class (mxDOUBLE_CLASS, ...)
+ * is stored with if no conversion is applied, and the equivalent bob type.
+ * Returns false for non-numeric classes.
+ */
+static bool class_type(uint32_t mx, uint32_t& mi,
+    bob::io::base::array::ElementType& eltype) {
+
+  switch (mx) {
+    case 6: mi = miDOUBLE; eltype = bob::io::base::array::t_float64; break;
+    case 7: mi = miSINGLE; eltype = bob::io::base::array::t_float32; break;
+    case 8: mi = miINT8; eltype = bob::io::base::array::t_int8; break;
+    case 9: mi = miUINT8; eltype = bob::io::base::array::t_uint8; break;
+    case 10: mi = miINT16; eltype = bob::io::base::array::t_int16; break;
+    case 11: mi = miUINT16; eltype = bob::io::base::array::t_uint16; break;
+    case 12: mi = miINT32; eltype = bob::io::base::array::t_int32; break;
+    case 13: mi = miUINT32; eltype = bob::io::base::array::t_uint32; break;
+    case 14: mi = miINT64; eltype = bob::io::base::array::t_int64; break;
+    case 15: mi = miUINT64; eltype = bob::io::base::array::t_uint64; break;
+    default: return false;
+  }
+  return true;
+
+}
+
+/**
+ * A data element, as found at some offset of the file
+ */
+struct mat_element {
+  uint32_t type;
+  uint64_t size; ///< of the data, in bytes
+  uint64_t data; ///< offset of the data on the file
+  uint64_t next; ///< offset of the element that follows this one
+};
+
+/**
+ * Read-only access to the file being walked through
+ */
+class mat_walker {
+
+  public: //api
+
+    mat_walker(const char* path): m_fd(::open(path, O_RDONLY)), m_size(0) {
+      struct stat st;
+      if (m_fd >= 0 && ::fstat(m_fd, &st) == 0) m_size = st.st_size;
+    }
+
+    ~mat_walker() { if (m_fd >= 0) ::close(m_fd); }
+
+    int fd() const { return m_fd; }
+
+    uint64_t size() const { return m_size; }
+
+    /**
+     * Reads n bytes at the given offset. Returns false if the file is not
+     * long enough.
+     */
+    bool read(uint64_t offset, void* buf, size_t n) const {
+      if (m_fd < 0 || offset + n > m_size) return false;
+      return ::pread(m_fd, buf, n, offset) == (ssize_t)n;
+    }
+
+    /**
+     * Reads the tag of the element at the given offset. Elements with up to
+     * 4 bytes of data may be packed with their tag in 8 bytes; all others
+     * are padded to 8 bytes, except for compressed variables.
+     */
+    bool element(uint64_t offset, mat_element& e) const {
+      uint32_t tag[2];
+      if (!read(offset, tag, sizeof(tag))) return false;
+      if (tag[0] >> 16) { //small data element
+        e.type = tag[0] & 0xffff;
+        e.size = tag[0] >> 16;
+        e.data = offset + 4;
+        e.next = offset + 8;
+      }
+      else {
+        e.type = tag[0];
+        e.size = tag[1];
+        e.data = offset + 8;
+        e.next = e.data + e.size;
+        if (e.type != miCOMPRESSED) e.next = e.data + ((e.size + 7) & ~uint64_t(7));
+      }
+      return e.data + e.size <= m_size;
+    }
+
+  private: //representation
+
+    int m_fd;
+    uint64_t m_size;
+
+};
+
+/**
+ * Checks the file is a version 5 file, written in the byte order of this
+ * machine
+ */
+static bool is_native_v5(const mat_walker& file) {
+
+  char header[128];
+  if (!file.read(0, header, sizeof(header))) return false;
+
+  // the version is 0x0100 for version 5 files and 0x0200 for version 7.3
+  uint16_t version;
+  std::memcpy(&version, header + 124, sizeof(version));
+  if (version != 0x0100) return false;
+
+  // the 'MI' indicator reads back as such only in the same byte order
+  uint16_t endian;
+  std::memcpy(&endian, header + 126, sizeof(endian));
+  return endian == (('M' << 8) | 'I');
+
+}
+
+/**
+ * Unmaps a region of a file, when the last pointer to it is released
+ */
+struct mat_unmapper {
+  void* base;
+  size_t length;
+  void operator() (const void*) const { ::munmap(base, length); }
+};
+
+boost::shared_ptr<const void> map_variable(const char* path,
+    const char* varname, mat_type& type) {
+
+  boost::shared_ptr<const void> retval;
+
+  mat_walker file(path);
+  if (!is_native_v5(file)) return retval;
+
+  mat_element var;
+  for (uint64_t offset = 128; file.element(offset, var); offset = var.next) {
+
+    if (var.type == miCOMPRESSED && !varname) return retval; //not mappable
+    if (var.type != miMATRIX) continue;
+
+    // array flags, dimensions and name
+    mat_element flags, dims, name;
+    if (!file.element(var.data, flags) || flags.type != miUINT32) return retval;
+    if (!file.element(flags.next, dims) || dims.type != miINT32) return retval;
+    if (!file.element(dims.next, name) || name.type != miINT8) return retval;
+
+    if (varname) {
+      std::string s(name.size, '\0');
+      if (!file.read(name.data, &s[0], name.size)) return retval;
+      if (s != varname) continue;
+    }
+
+    // we found the variable: checks it can be used as it is on the file
+    uint32_t words[2];
+    if (flags.size != sizeof(words) || !file.read(flags.data, words, sizeof(words))) return retval;
+    if (words[0] & COMPLEX_FLAG) return retval;
+
+    uint32_t mi;
+    bob::io::base::array::ElementType eltype;
+    if (!class_type(words[0] & 0xff, mi, eltype)) return retval;
+
+    // logical arrays are stored as uint8 arrays, one byte per element
+    if (words[0] & LOGICAL_FLAG) {
+      if (eltype != bob::io::base::array::t_uint8) return retval;
+      eltype = bob::io::base::array::t_bool;
+    }
+
+    size_t nd = dims.size / sizeof(int32_t);
+    if (nd == 0) return retval;
+    std::vector<int32_t> shape(nd);
+    if (!file.read(dims.data, &shape[0], nd * sizeof(int32_t))) return retval;
+
+    uint64_t count = 1;
+    for (size_t k=0; k<nd; ++k) {
+      if (shape[k] < 0) return retval;
+      count *= shape[k];
+    }
+
+    mat_element data;
+    if (!file.element(name.next, data) || data.type != mi) return retval;
+    size_t elsize = bob::io::base::array::getElementSize(eltype);
+    if (count == 0 || data.size != count * elsize) return retval;
+
+    // data may be misaligned if it follows compressed variables, which are
+    // not padded
+    if (data.data % elsize) return retval;
+
+    // maps the pages the data lies on
+    uint64_t page = ::sysconf(_SC_PAGESIZE);
+    uint64_t start = data.data - (data.data % page);
+    size_t length = data.data + data.size - start;
+    void* base = ::mmap(0, length, PROT_READ, MAP_SHARED, file.fd(), start);
+    if (base == MAP_FAILED) return retval;
+
+    mat_unmapper unmapper = {base, length};
+    retval.reset(static_cast<const char*>(base) + (data.data - start), unmapper);
+    type.dtype = eltype;
+    type.shape.assign(shape.begin(), shape.end());
+    return retval;
+
+  }
+
+  return retval;
+
+}
@@ -0,0 +1,30 @@
+/**
+ * @date Fri 16 Oct 15:58:44 2026 UTC
+ *
+ * @brief Zero-copy access to the data of uncompressed variables in version 5
+ * .mat files, through a read-only memory mapping of the file.
+ */
+
+#ifndef BOB_IO_MATLAB_MAPPING_H
+#define BOB_IO_MATLAB_MAPPING_H
+
+#include <boost/shared_ptr.hpp>
+#include "utils.h"
+
+/**
+ * Maps the data of a variable of a version 5 .mat file to memory. If varname
+ * is null, maps the first variable in the file.
+ *
+ * Returns a pointer to the data, in column-major order, and sets type to the
+ * type and shape of the variable. The file is unmapped once the last copy of
+ * the returned pointer is released.
+ *
+ * Only real, numeric (or logical) variables stored without compression, in
+ * the byte order of this machine and with the same element type as their
+ * class can be mapped. For all others (and for other file versions), returns
+ * an empty pointer and the variable must be read the usual way.
+ */
+boost::shared_ptr<const void> map_variable(const char* path,
+    const char* varname, mat_type& type);
+
+#endif /* BOB_IO_MATLAB_MAPPING_H */
@@ -0,0 +1,480 @@
+/**
+ * @date Fri 16 Oct 15:43:27 2026 UTC
+ *
+ * @brief Cache-blocked and vectorized re-ordering of arrays between row-major
+ * and column-major orders.
+ *
+ * An N-dimensional re-ordering only swaps the roles of the first and the last
+ * dimensions as the fastest varying ones. It is therefore decomposed into a
+ * series of 2D transpositions between those two dimensions, one for each
+ * combination of the indexes in the middle dimensions. Each 2D transposition
+ * is done in square tiles so both the source and the destination are walked
+ * inside the cache. 4 and 8 byte elements are transposed with SSE2 or AVX in
+ * blocks of registers, if the processor supports it.
+ */
+
+#include "reorder.h"
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+#include "threads.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define BOB_IO_MATLAB_X86_KERNELS
+#  include <immintrin.h>
+#endif
+
+/**
+ * Side of the square tiles, in elements. Two tiles of 8 byte elements fit in
+ * the L1 data cache of any processor we care about.
+ */
+static const size_t TILE = 32;
+
+/**
+ * Signature of a 2D transposition where the source is contiguous along rows
+ * and the destination contiguous along columns:
+ *
+ * dst[r*dst_ld + c] = src[c*src_ld + r], for r < rows and c < cols
+ */
+typedef void (*transpose_t)(const void* src, size_t src_ld, void* dst,
+    size_t dst_ld, size_t rows, size_t cols);
+
+/**
+ * Scalar transposition of the [r0, r1) x [c0, c1) block
+ */
+template <typename T>
+static inline void transpose_block(const T* src, size_t src_ld, T* dst,
+    size_t dst_ld, size_t r0, size_t r1, size_t c0, size_t c1) {
+  for (size_t r = r0; r < r1; ++r)
+    for (size_t c = c0; c < c1; ++c)
+      dst[r*dst_ld + c] = src[c*src_ld + r];
+}
+
+template <typename T>
+static void transpose_scalar(const void* src_, size_t src_ld, void* dst_,
+    size_t dst_ld, size_t rows, size_t cols) {
+  const T* src = static_cast<const T*>(src_);
+  T* dst = static_cast<T*>(dst_);
+  for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+    size_t r1 = std::min(rows, r0 + TILE);
+    for (size_t c0 = 0; c0 < cols; c0 += TILE) {
+      transpose_block(src, src_ld, dst, dst_ld, r0, r1, c0,
+          std::min(cols, c0 + TILE));
+    }
+  }
+}
+
+#if defined(BOB_IO_MATLAB_X86_KERNELS)
+
+__attribute__((target("sse2")))
+static void transpose_sse2_4(const void* src_, size_t src_ld, void* dst_,
+    size_t dst_ld, size_t rows, size_t cols) {
+  const float* src = static_cast<const float*>(src_);
+  float* dst = static_cast<float*>(dst_);
+  for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+    size_t r1 = std::min(rows, r0 + TILE);
+    for (size_t c0 = 0; c0 < cols; c0 += TILE) {
+      size_t c1 = std::min(cols, c0 + TILE);
+      size_t r = r0;
+      for (; r + 4 <= r1; r += 4) {
+        size_t c = c0;
+        for (; c + 4 <= c1; c += 4) {
+          const float* s = src + c*src_ld + r;
+          __m128 a = _mm_loadu_ps(s);
+          __m128 b = _mm_loadu_ps(s + src_ld);
+          __m128 d = _mm_loadu_ps(s + 2*src_ld);
+          __m128 e = _mm_loadu_ps(s + 3*src_ld);
+          _MM_TRANSPOSE4_PS(a, b, d, e);
+          float* o = dst + r*dst_ld + c;
+          _mm_storeu_ps(o, a);
+          _mm_storeu_ps(o + dst_ld, b);
+          _mm_storeu_ps(o + 2*dst_ld, d);
+          _mm_storeu_ps(o + 3*dst_ld, e);
+        }
+        transpose_block(src, src_ld, dst, dst_ld, r, r + 4, c, c1);
+      }
+      transpose_block(src, src_ld, dst, dst_ld, r, r1, c0, c1);
+    }
+  }
+}
+
+__attribute__((target("sse2")))
+static void transpose_sse2_8(const void* src_, size_t src_ld, void* dst_,
+    size_t dst_ld, size_t rows, size_t cols) {
+  const double* src = static_cast<const double*>(src_);
+  double* dst = static_cast<double*>(dst_);
+  for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+    size_t r1 = std::min(rows, r0 + TILE);
+    for (size_t c0 = 0; c0 < cols; c0 += TILE) {
+      size_t c1 = std::min(cols, c0 + TILE);
+      size_t r = r0;
+      for (; r + 2 <= r1; r += 2) {
+        size_t c = c0;
+        for (; c + 2 <= c1; c += 2) {
+          const double* s = src + c*src_ld + r;
+          __m128d a = _mm_loadu_pd(s);
+          __m128d b = _mm_loadu_pd(s + src_ld);
+          double* o = dst + r*dst_ld + c;
+          _mm_storeu_pd(o, _mm_unpacklo_pd(a, b));
+          _mm_storeu_pd(o + dst_ld, _mm_unpackhi_pd(a, b));
+        }
+        transpose_block(src, src_ld, dst, dst_ld, r, r + 2, c, c1);
+      }
+      transpose_block(src, src_ld, dst, dst_ld, r, r1, c0, c1);
+    }
+  }
+}
+
+__attribute__((target("avx")))
+static void transpose_avx_4(const void* src_, size_t src_ld, void* dst_,
+    size_t dst_ld, size_t rows, size_t cols) {
+  const float* src = static_cast<const float*>(src_);
+  float* dst = static_cast<float*>(dst_);
+  for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+    size_t r1 = std::min(rows, r0 + TILE);
+    for (size_t c0 = 0; c0 < cols; c0 += TILE) {
+      size_t c1 = std::min(cols, c0 + TILE);
+      size_t r = r0;
+      for (; r + 8 <= r1; r += 8) {
+        size_t c = c0;
+        for (; c + 8 <= c1; c += 8) {
+          const float* s = src + c*src_ld + r;
+          __m256 v[8], t[8];
+          for (size_t k = 0; k < 8; ++k) v[k] = _mm256_loadu_ps(s + k*src_ld);
+          for (size_t k = 0; k < 8; k += 2) {
+            t[k] = _mm256_unpacklo_ps(v[k], v[k+1]);
+            t[k+1] = _mm256_unpackhi_ps(v[k], v[k+1]);
+          }
+          for (size_t k = 0; k < 8; k += 4) {
+            v[k] = _mm256_shuffle_ps(t[k], t[k+2], _MM_SHUFFLE(1,0,1,0));
+            v[k+1] = _mm256_shuffle_ps(t[k], t[k+2], _MM_SHUFFLE(3,2,3,2));
+            v[k+2] = _mm256_shuffle_ps(t[k+1], t[k+3], _MM_SHUFFLE(1,0,1,0));
+            v[k+3] = _mm256_shuffle_ps(t[k+1], t[k+3], _MM_SHUFFLE(3,2,3,2));
+          }
+          float* o = dst + r*dst_ld + c;
+          for (size_t k = 0; k < 4; ++k) {
+            _mm256_storeu_ps(o + k*dst_ld, _mm256_permute2f128_ps(v[k], v[k+4], 0x20));
+            _mm256_storeu_ps(o + (k+4)*dst_ld, _mm256_permute2f128_ps(v[k], v[k+4], 0x31));
+          }
+        }
+        transpose_block(src, src_ld, dst, dst_ld, r, r + 8, c, c1);
+      }
+      transpose_block(src, src_ld, dst, dst_ld, r, r1, c0, c1);
+    }
+  }
+}
+
+__attribute__((target("avx")))
+static void transpose_avx_8(const void* src_, size_t src_ld, void* dst_,
+    size_t dst_ld, size_t rows, size_t cols) {
+  const double* src = static_cast<const double*>(src_);
+  double* dst = static_cast<double*>(dst_);
+  for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+    size_t r1 = std::min(rows, r0 + TILE);
+    for (size_t c0 = 0; c0 < cols; c0 += TILE) {
+      size_t c1 = std::min(cols, c0 + TILE);
+      size_t r = r0;
+      for (; r + 4 <= r1; r += 4) {
+        size_t c = c0;
+        for (; c + 4 <= c1; c += 4) {
+          const double* s = src + c*src_ld + r;
+          __m256d a = _mm256_loadu_pd(s);
+          __m256d b = _mm256_loadu_pd(s + src_ld);
+          __m256d d = _mm256_loadu_pd(s + 2*src_ld);
+          __m256d e = _mm256_loadu_pd(s + 3*src_ld);
+          __m256d t0 = _mm256_unpacklo_pd(a, b);
+          __m256d t1 = _mm256_unpackhi_pd(a, b);
+          __m256d t2 = _mm256_unpacklo_pd(d, e);
+          __m256d t3 = _mm256_unpackhi_pd(d, e);
+          double* o = dst + r*dst_ld + c;
+          _mm256_storeu_pd(o, _mm256_permute2f128_pd(t0, t2, 0x20));
+          _mm256_storeu_pd(o + dst_ld, _mm256_permute2f128_pd(t1, t3, 0x20));
+          _mm256_storeu_pd(o + 2*dst_ld, _mm256_permute2f128_pd(t0, t2, 0x31));
+          _mm256_storeu_pd(o + 3*dst_ld, _mm256_permute2f128_pd(t1, t3, 0x31));
+        }
+        transpose_block(src, src_ld, dst, dst_ld, r, r + 4, c, c1);
+      }
+      transpose_block(src, src_ld, dst, dst_ld, r, r1, c0, c1);
+    }
+  }
+}
+
+#endif /* BOB_IO_MATLAB_X86_KERNELS */
+
+/**
+ * Selects the fastest transposition kernel for the element size, or returns
+ * 0 if there is none.
+ */
+static transpose_t select_kernel(size_t elsize) {
+#if defined(BOB_IO_MATLAB_X86_KERNELS)
+  static const bool has_avx = (__builtin_cpu_init(), __builtin_cpu_supports("avx"));
+  static const bool has_sse2 = __builtin_cpu_supports("sse2");
+  if (elsize == 4 && has_avx) return transpose_avx_4;
+  if (elsize == 8 && has_avx) return transpose_avx_8;
+  if (elsize == 4 && has_sse2) return transpose_sse2_4;
+  if (elsize == 8 && has_sse2) return transpose_sse2_8;
+#endif
+  switch (elsize) {
+    case 1: return transpose_scalar<uint8_t>;
+    case 2: return transpose_scalar<uint16_t>;
+    case 4: return transpose_scalar<uint32_t>;
+    case 8: return transpose_scalar<uint64_t>;
+    default: return 0;
+  }
+}
+
+/**
+ * Tiled copy of a 2D block between arbitrary (element) strides. Used to split
+ * or interleave complex numbers, where one of the sides is not contiguous.
+ */
+template <typename T>
+static void copy_strided(const void* src_, size_t src_rs, size_t src_cs,
+    void* dst_, size_t dst_rs, size_t dst_cs, size_t rows, size_t cols) {
+  const T* src = static_cast<const T*>(src_);
+  T* dst = static_cast<T*>(dst_);
+  for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+    size_t r1 = std::min(rows, r0 + TILE);
+    for (size_t c0 = 0; c0 < cols; c0 += TILE) {
+      size_t c1 = std::min(cols, c0 + TILE);
+      for (size_t r = r0; r < r1; ++r)
+        for (size_t c = c0; c < c1; ++c)
+          dst[r*dst_rs + c*dst_cs] = src[r*src_rs + c*src_cs];
+    }
+  }
+}
+
+static void copy_strided_bytes(size_t elsize, const void* src_, size_t src_rs,
+    size_t src_cs, void* dst_, size_t dst_rs, size_t dst_cs, size_t rows,
+    size_t cols) {
+  const char* src = static_cast<const char*>(src_);
+  char* dst = static_cast<char*>(dst_);
+  for (size_t r = 0; r < rows; ++r)
+    for (size_t c = 0; c < cols; ++c)
+      std::memcpy(dst + (r*dst_rs + c*dst_cs)*elsize,
+          src + (r*src_rs + c*src_cs)*elsize, elsize);
+}
+
+/**
+ * Copies a 2D block of elements between the given strides. Picks the
+ * transposition kernels when their layout matches.
+ */
+static void copy_2d(size_t elsize, const void* src, size_t src_rs,
+    size_t src_cs, void* dst, size_t dst_rs, size_t dst_cs, size_t rows,
+    size_t cols) {
+
+  if (src_rs == 1 && dst_cs == 1) {
+    transpose_t kernel = select_kernel(elsize);
+    if (kernel) {
+      kernel(src, src_cs, dst, dst_rs, rows, cols);
+      return;
+    }
+  }
+
+  else if (src_cs == 1 && dst_rs == 1) { //same, with rows and columns swapped
+    transpose_t kernel = select_kernel(elsize);
+    if (kernel) {
+      kernel(src, src_rs, dst, dst_cs, cols, rows);
+      return;
+    }
+  }
+
+  switch (elsize) {
+    case 1:
+      copy_strided<uint8_t>(src, src_rs, src_cs, dst, dst_rs, dst_cs, rows, cols);
+      break;
+    case 2:
+      copy_strided<uint16_t>(src, src_rs, src_cs, dst, dst_rs, dst_cs, rows, cols);
+      break;
+    case 4:
+      copy_strided<uint32_t>(src, src_rs, src_cs, dst, dst_rs, dst_cs, rows, cols);
+      break;
+    case 8:
+      copy_strided<uint64_t>(src, src_rs, src_cs, dst, dst_rs, dst_cs, rows, cols);
+      break;
+    default:
+      copy_strided_bytes(elsize, src, src_rs, src_cs, dst, dst_rs, dst_cs, rows, cols);
+  }
+}
+
+/**
+ * Minimum size, in bytes, of an array for it to be re-ordered with more than
+ * one thread. Below it, starting the threads costs more than they save.
+ */
+static const size_t MIN_THREADED_BYTES = 4 << 20;
+
+/**
+ * Re-ordering of an array, split in units of work that are independent from
+ * each other: a range of columns of the 2D transposition between the first
+ * and the last dimension, for one combination of the indexes in the middle
+ * dimensions.
+ */
+struct reorder_plan {
+
+  const char* src;
+  char* dst;
+  size_t src_pitch; ///< elements between two consecutive source elements
+  size_t dst_pitch; ///< elements between two consecutive destination elements
+  size_t elsize;
+  std::vector<size_t> dims; ///< shape, without dimensions of length 1
+  std::vector<size_t> src_strides; ///< strides of the source, in elements
+  std::vector<size_t> dst_strides; ///< strides of the destination, in elements
+  size_t columns; ///< number of columns in each unit of work
+  size_t units; ///< total number of units of work
+
+  /**
+   * Runs the units of work in [begin, end)
+   */
+  void run(size_t begin, size_t end) const {
+    const size_t n = dims.size();
+    const size_t chunks = (dims[n-1] + columns - 1) / columns;
+    for (size_t unit = begin; unit < end; ++unit) {
+      size_t middle = unit / chunks;
+      size_t c0 = (unit % chunks) * columns;
+      size_t c1 = std::min(dims[n-1], c0 + columns);
+      size_t src_offset = c0*src_strides[n-1];
+      size_t dst_offset = c0*dst_strides[n-1];
+      for (size_t k=n-2; k>0; --k) {
+        src_offset += (middle % dims[k]) * src_strides[k];
+        dst_offset += (middle % dims[k]) * dst_strides[k];
+        middle /= dims[k];
+      }
+      copy_2d(elsize,
+          src + src_offset*src_pitch*elsize, src_strides[0]*src_pitch,
+          src_strides[n-1]*src_pitch,
+          dst + dst_offset*dst_pitch*elsize, dst_strides[0]*dst_pitch,
+          dst_strides[n-1]*dst_pitch,
+          dims[0], c1 - c0);
+    }
+  }
+
+};
+
+/**
+ * Re-orders an array, from column-major into row-major order if to_row is
+ * set, or the other way around otherwise. src_pitch and dst_pitch are the
+ * distances, in elements, between two consecutive elements of each of the
+ * arrays (2 for the parts of an interleaved complex array, 1 otherwise).
+ */
+static void reorder(const void* src, size_t src_pitch, void* dst,
+    size_t dst_pitch, size_t elsize, size_t nd, const size_t* shape,
+    bool to_row, size_t threads) {
+
+  reorder_plan plan;
+  plan.src = static_cast<const char*>(src);
+  plan.dst = static_cast<char*>(dst);
+  plan.src_pitch = src_pitch;
+  plan.dst_pitch = dst_pitch;
+  plan.elsize = elsize;
+
+  // dimensions of length 1 do not change the position of any element
+  plan.dims.reserve(nd);
+  size_t elements = 1;
+  for (size_t k=0; k<nd; ++k) {
+    if (shape[k] == 0) return; ///< empty array
+    if (shape[k] != 1) plan.dims.push_back(shape[k]);
+    elements *= shape[k];
+  }
+
+  const size_t n = plan.dims.size();
+
+  if (n <= 1) { //same layout on both orders
+    if (src_pitch == 1 && dst_pitch == 1)
+      std::memcpy(dst, src, elements*elsize);
+    else
+      copy_2d(elsize, src, src_pitch, 0, dst, dst_pitch, 0, elements, 1);
+    return;
+  }
+
+  // strides, in elements, for the row-major and column-major orders
+  std::vector<size_t> rs(n), cs(n);
+  rs[n-1] = 1;
+  for (size_t k=n-1; k>0; --k) rs[k-1] = rs[k] * plan.dims[k];
+  cs[0] = 1;
+  for (size_t k=1; k<n; ++k) cs[k] = cs[k-1] * plan.dims[k-1];
+  plan.src_strides = to_row ? cs : rs;
+  plan.dst_strides = to_row ? rs : cs;
+
+  const size_t middle = elements / (plan.dims[0] * plan.dims[n-1]);
+
+  if (threads <= 1 || elements*elsize < MIN_THREADED_BYTES) {
+    plan.columns = plan.dims[n-1];
+    plan.units = middle;
+    plan.run(0, plan.units);
+    return;
+  }
+
+  // if there are not enough middle indexes to keep all threads busy, also
+  // split the columns, by multiples of the tile size
+  plan.columns = plan.dims[n-1];
+  if (middle < threads) {
+    size_t splits = (threads + middle - 1) / middle;
+    size_t columns = (plan.dims[n-1] + splits - 1) / splits;
+    plan.columns = std::max(TILE, (columns + TILE - 1) / TILE * TILE);
+  }
+  plan.units = middle * ((plan.dims[n-1] + plan.columns - 1) / plan.columns);
+  threads = std::min(threads, plan.units);
+
+  // the calling thread takes its share of the work as well, and the shares
+  // of the threads that could not be started, if any
+  thread_group workers;
+  size_t started = 1;
+  for (; started<threads; ++started) {
+    const size_t begin = (started*plan.units)/threads;
+    const size_t end = ((started+1)*plan.units)/threads;
+    if (!workers.start([&plan, begin, end]() { plan.run(begin, end); })) break;
+  }
+  plan.run(0, plan.units/threads);
+  plan.run((started*plan.units)/threads, plan.units);
+  workers.join();
+
+}
+
+void row_to_col_order(const void* src, void* dst, size_t elsize, size_t nd,
+    const size_t* shape, size_t threads) {
+  reorder(src, 1, dst, 1, elsize, nd, shape, false, threads);
+}
+
+void col_to_row_order(const void* src, void* dst, size_t elsize, size_t nd,
+    const size_t* shape, size_t threads) {
+  reorder(src, 1, dst, 1, elsize, nd, shape, true, threads);
+}
+
+void row_to_col_order_complex(const void* src, void* dst_re, void* dst_im,
+    size_t elsize, size_t nd, const size_t* shape, size_t threads) {
+  reorder(src, 2, dst_re, 1, elsize, nd, shape, false, threads);
+  reorder(static_cast<const char*>(src) + elsize, 2, dst_im, 1, elsize, nd,
+      shape, false, threads);
+}
+
+void col_to_row_order_complex(const void* src_re, const void* src_im,
+    void* dst, size_t elsize, size_t nd, const size_t* shape,
+    size_t threads) {
+  reorder(src_re, 1, dst, 2, elsize, nd, shape, true, threads);
+  reorder(src_im, 1, static_cast<char*>(dst) + elsize, 2, elsize, nd, shape,
+      true, threads);
+}
+
+void row_to_col_order(const void* src, void* dst,
+    const bob::io::base::array::typeinfo& info, size_t threads) {
+  row_to_col_order(src, dst, info.item_size(), info.nd, info.shape, threads);
+}
+
+void col_to_row_order(const void* src, void* dst,
+    const bob::io::base::array::typeinfo& info, size_t threads) {
+  col_to_row_order(src, dst, info.item_size(), info.nd, info.shape, threads);
+}
+
+void row_to_col_order_complex(const void* src, void* dst_re, void* dst_im,
+    const bob::io::base::array::typeinfo& info, size_t threads) {
+  row_to_col_order_complex(src, dst_re, dst_im, info.item_size()/2, info.nd,
+      info.shape, threads);
+}
+
+void col_to_row_order_complex(const void* src_re, const void* src_im,
+    void* dst, const bob::io::base::array::typeinfo& info, size_t threads) {
+  col_to_row_order_complex(src_re, src_im, dst, info.item_size()/2, info.nd,
+      info.shape, threads);
+}
@@ -0,0 +1,68 @@
+/**
+ * @date Fri 16 Oct 15:43:27 2026 UTC
+ *
+ * @brief Re-ordering of arrays between the row-major (C) order used by numpy
+ * and bob and the column-major (Fortran) order used by matio.
+ *
+ * Contrary to the generic versions in bob.io.base, these work on blocks that
+ * fit in cache and use SSE2 or AVX kernels, chosen at runtime, for 4 and 8
+ * byte elements.
+ *
+ * All functions take an optional number of threads to split the work among,
+ * for arrays that are large enough to benefit from it.
+ */
+
+#ifndef BOB_IO_MATLAB_REORDER_H
+#define BOB_IO_MATLAB_REORDER_H
+
+#include <cstddef>
+#include <bob.io.base/array.h>
+
+/**
+ * Copies an array with nd dimensions of the given shape, made of elements of
+ * elsize bytes, from row-major (src) to column-major (dst) order. The shape
+ * is given in the usual (row-major) order.
+ */
+void row_to_col_order(const void* src, void* dst, size_t elsize, size_t nd,
+    const size_t* shape, size_t threads=1);
+
+/**
+ * Copies an array with nd dimensions of the given shape, made of elements of
+ * elsize bytes, from column-major (src) to row-major (dst) order.
+ */
+void col_to_row_order(const void* src, void* dst, size_t elsize, size_t nd,
+    const size_t* shape, size_t threads=1);
+
+/**
+ * Copies an interleaved complex array from row-major order into split real
+ * and imaginary arrays in column-major order. elsize is the size of each of
+ * the real and imaginary parts of an element.
+ */
+void row_to_col_order_complex(const void* src, void* dst_re, void* dst_im,
+    size_t elsize, size_t nd, const size_t* shape, size_t threads=1);
+
+/**
+ * Copies split real and imaginary arrays in column-major order into an
+ * interleaved complex array in row-major order. elsize is the size of each
+ * of the real and imaginary parts of an element.
+ */
+void col_to_row_order_complex(const void* src_re, const void* src_im,
+    void* dst, size_t elsize, size_t nd, const size_t* shape,
+    size_t threads=1);
+
+/**
+ * Same as above, taking the element type and shape from a typeinfo
+ */
+void row_to_col_order(const void* src, void* dst,
+    const bob::io::base::array::typeinfo& info, size_t threads=1);
+
+void col_to_row_order(const void* src, void* dst,
+    const bob::io::base::array::typeinfo& info, size_t threads=1);
+
+void row_to_col_order_complex(const void* src, void* dst_re, void* dst_im,
+    const bob::io::base::array::typeinfo& info, size_t threads=1);
+
+void col_to_row_order_complex(const void* src_re, const void* src_im,
+    void* dst, const bob::io::base::array::typeinfo& info, size_t threads=1);
+
+#endif /* BOB_IO_MATLAB_REORDER_H */
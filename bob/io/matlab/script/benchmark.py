@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+# vim: set fileencoding=utf-8 :
+# Fri 16 Oct 2026 16:25:21 UTC
+
+"""Compares the throughput and size of compressed and uncompressed .mat files
+
+The matrix written is a tiled ramp, which is about as compressible as our
+feature archives. Each measurement is repeated and the best time is kept.
+Throughput is given in MB/s of uncompressed data.
+"""
+
+import os
+import sys
+import time
+
+import numpy
+
+
+def _best(repeat, function):
+  """Returns the best wall-clock time, in seconds, of running ``function``"""
+
+  best = None
+  for _ in range(repeat):
+    start = time.time()
+    function()
+    elapsed = time.time() - start
+    if best is None or elapsed < best: best = elapsed
+  return best
+
+
+def _measure(data, compression, version, repeat):
+  """Writes and reads back ``data``, returning sizes and timings"""
+
+  from bob.io.base import test_utils
+  from .. import write_matrix, read_matrix
+
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    def write():
+      if os.path.exists(filename): os.unlink(filename)
+      write_matrix(filename, 'data', data, compression=compression,
+          version=version)
+    write_time = _best(repeat, write)
+    read_time = _best(repeat, lambda: read_matrix(filename, 'data'))
+    assert numpy.array_equal(read_matrix(filename, 'data'), data)
+    return os.path.getsize(filename), write_time, read_time
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+
+def main(user_input=None):
+
+  import argparse
+
+  prog = os.path.basename(sys.argv[0])
+  parser = argparse.ArgumentParser(prog=prog,
+      description=__doc__.split('\n')[0],
+      epilog=' '.join(__doc__.split('\n')[2:]).strip())
+  parser.add_argument('-r', '--rows', type=int, default=2000,
+      help='Number of rows of the written matrix (default: %(default)s)')
+  parser.add_argument('-c', '--cols', type=int, default=1000,
+      help='Number of columns of the written matrix (default: %(default)s)')
+  parser.add_argument('-n', '--repeat', type=int, default=3,
+      help='Number of times each measurement is repeated (default: %(default)s)')
+  parser.add_argument('-v', '--version', default='5', choices=('4', '5', '7.3'),
+      help='Format of the written files (default: %(default)s)')
+  args = parser.parse_args(user_input)
+
+  data = numpy.tile(numpy.arange(args.cols, dtype='float64'), (args.rows, 1))
+  megabytes = data.nbytes / float(1 << 20)
+
+  print("%d x %d float64 matrix (%.1f MB), version %s, best of %d" % \
+      (args.rows, args.cols, megabytes, args.version, args.repeat))
+  print("%-12s %12s %8s %14s %14s" % \
+      ('', 'size (bytes)', 'ratio', 'write (MB/s)', 'read (MB/s)'))
+
+  plain = None
+  for compression in (False, True):
+    size, write_time, read_time = _measure(data, compression, args.version,
+        args.repeat)
+    if plain is None: plain = size
+    print("%-12s %12d %8.2f %14.1f %14.1f" % \
+        ('compressed' if compression else 'plain', size, float(plain) / size,
+          megabytes / write_time, megabytes / read_time))
+
+  return 0
@@ -12,11 +12,16 @@ import os
 import sys
 import numpy
 import nose.tools
+import nose.plugins.skip
 
-from bob.io.base import load, test_utils
+import bob.io.base
+
+from bob.io.base import load, save, test_utils
 from bob.io.base.test_file import transcode, array_readwrite, arrayset_readwrite
 
-from . import read_varnames, read_matrix
+from . import read_varnames, read_vartypes, read_matrix, read_slice, \
+    write_matrix, set_options, get_options, BlockReader, read_many, \
+    append_many, read_struct, CellArray, read_sparse, MatArchive
 
 def test_all():
 
@@ -58,10 +63,27 @@ def test_all():
   transcode(test_utils.datafile('test_4d_cplx.mat', __name__))
   transcode(test_utils.datafile('test.mat', __name__)) #3D complex, large
 
-@nose.tools.nottest
-def test_mat_file_io_does_not_crash():
+def test_cell():
+
+  # elements are decoded as they are indexed
+  filename = test_utils.datafile('test_cell.mat', __name__)
+  cells = CellArray(filename, 'cells')
+  assert cells.shape == (1,2)
+  assert len(cells) == 2
+  assert numpy.array_equal(cells[1], [[2., 3.]])
+  assert numpy.array_equal(cells[-2], [[1.]])
+  assert [k.shape for k in cells] == [(1,1), (1,2)]
+  nose.tools.assert_raises(IndexError, cells.__getitem__, 2)
+  nose.tools.assert_raises(RuntimeError, CellArray, filename, 'none')
+
+  # objects which were not initialized raise instead of crashing
+  empty = CellArray.__new__(CellArray)
+  nose.tools.assert_raises(RuntimeError, len, empty)
+  nose.tools.assert_raises(RuntimeError, empty.__getitem__, 0)
+  nose.tools.assert_raises(RuntimeError, getattr, empty, 'shape')
 
-  data = load(test_utils.datafile('test_cell.mat', __name__))
+  # the codec only reads numeric arrays
+  nose.tools.assert_raises(RuntimeError, load, filename)
 
 def test_interface():
 
@@ -79,3 +101,514 @@ def test_interface():
     for j in range(3):
       assert x[i,j] == float(j*2+i+1)
       assert y[j,i] == float(j*2+i+1)
+
+def test_vartypes():
+
+  # each variable is typed from its own header
+  mixed_file = test_utils.datafile('test_2d.mat', __name__)
+  types = dict(zip(read_varnames(mixed_file), read_vartypes(mixed_file)))
+  assert types['x'][0] == numpy.dtype('float64')
+  assert types['x'][1] == (2,3)
+  assert types['y'][0] == numpy.dtype('float64')
+  assert types['y'][1] == (3,2)
+
+  # variables cannot be stacked, so only the first one is loaded
+  assert numpy.array_equal(load(mixed_file), read_matrix(mixed_file, 'x'))
+
+def test_compression():
+
+  data = numpy.tile(numpy.arange(100, dtype='float64'), (200, 1))
+  plain = test_utils.temporary_filename(suffix='.mat')
+  compressed = test_utils.temporary_filename(suffix='.mat')
+
+  try:
+    write_matrix(plain, 'data', data, compression=False)
+    write_matrix(compressed, 'data', data, compression=True)
+    assert os.path.getsize(compressed) < os.path.getsize(plain)
+    assert numpy.array_equal(read_matrix(plain, 'data'), data)
+    assert numpy.array_equal(read_matrix(compressed, 'data'), data)
+
+    # the codec picks up the module options
+    previous = get_options()
+    set_options(compression=True)
+    try:
+      assert get_options()['compression']
+      os.unlink(compressed)
+      save(data, compressed)
+      assert os.path.getsize(compressed) < os.path.getsize(plain)
+      assert numpy.array_equal(load(compressed), data)
+    finally:
+      set_options(**previous)
+
+  finally:
+    for f in (plain, compressed):
+      if os.path.exists(f): os.unlink(f)
+
+def test_benchmark():
+
+  from .script.benchmark import main
+  assert main(['--rows=20', '--cols=30', '--repeat=1']) == 0
+
+def test_threads():
+
+  # large enough to be re-ordered by several threads
+  data = numpy.random.random_sample((1100, 3, 400)).astype('float32')
+  filename = test_utils.temporary_filename(suffix='.mat')
+
+  previous = get_options()
+  set_options(threads=4)
+  try:
+    assert get_options()['threads'] == 4
+    write_matrix(filename, 'data', data)
+    assert numpy.array_equal(read_matrix(filename, 'data'), data)
+    assert numpy.array_equal(load(filename), data)
+    nose.tools.assert_raises(ValueError, set_options, threads=0)
+  finally:
+    set_options(**previous)
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_append_many():
+
+  arrays = [numpy.random.normal(size=(3,4)) for k in range(10)]
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    assert append_many(filename, arrays[:6]) == 0
+    assert append_many(filename, arrays[6:]) == 6
+    assert read_varnames(filename) == tuple('array_%d' % k for k in range(10))
+    f = bob.io.base.File(filename, 'r')
+    assert len(f) == 10
+    for k, array in enumerate(arrays):
+      assert numpy.array_equal(f.read(k), array)
+    del f
+
+    # variables of the same type are loaded as a single, stacked array
+    assert numpy.array_equal(load(filename), numpy.array(arrays))
+    nose.tools.assert_raises(RuntimeError, append_many, filename, [numpy.zeros((2,2))])
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_versions():
+
+  data = numpy.random.normal(size=(20,3)).astype('float64')
+
+  for version in ('4', '5'):
+    filename = test_utils.temporary_filename(suffix='.mat')
+    try:
+      write_matrix(filename, 'data', data, version=version)
+      with open(filename, 'rb') as f: header = f.read(128)
+      if version == '5': assert header.startswith(b'MATLAB 5.0 MAT-file')
+      else: assert not header.startswith(b'MATLAB 5.0 MAT-file')
+      assert numpy.array_equal(read_matrix(filename, 'data'), data)
+    finally:
+      if os.path.exists(filename): os.unlink(filename)
+
+  nose.tools.assert_raises(ValueError, set_options, version='6')
+
+def test_version_73():
+
+  from .version import mat73
+  if not mat73:
+    raise nose.plugins.skip.SkipTest("matio was compiled without HDF5 (v7.3) support")
+
+  data = numpy.random.normal(size=(50,3,2)).astype('float32')
+  cplx = (numpy.random.normal(size=(20,4)) + 1j * numpy.random.normal(size=(20,4)))
+
+  # with chunk set, arrays with more rows are written by blocks of rows
+  for chunk in (0, 7, 64):
+    filename = test_utils.temporary_filename(suffix='.mat')
+    try:
+      write_matrix(filename, 'data', data, version='7.3', chunk=chunk)
+      write_matrix(filename, 'cplx', cplx, version='7.3', chunk=chunk)
+      with open(filename, 'rb') as f: header = f.read(128)
+      assert header.startswith(b'MATLAB 7.3 MAT-file')
+      assert numpy.array_equal(read_matrix(filename, 'data'), data)
+      assert numpy.array_equal(read_matrix(filename, 'cplx'), cplx)
+      assert numpy.array_equal(read_slice(filename, 'data', (10,1,0), None, (15,2,2)), data[10:25,1:3,:])
+    finally:
+      if os.path.exists(filename): os.unlink(filename)
+
+def test_slice():
+
+  # compressed 2D and 4D variables
+  filename = test_utils.datafile('test_2d.mat', __name__)
+  x = read_matrix(filename, 'x')
+  nose.tools.eq_(read_slice(filename, 'x', (1,0), None, (1,3)).tolist(), x[1:2,:].tolist())
+  nose.tools.eq_(read_slice(filename, 'x', (0,0), (1,2), (2,2)).tolist(), x[:,::2].tolist())
+
+  filename = test_utils.datafile('test_4d_cplx.mat', __name__)
+  x = read_matrix(filename, 'x')
+  assert numpy.array_equal(read_slice(filename, 'x', (1,0,1,2), (1,2,1,1), (1,2,3,3)), x[1:2,0:3:2,1:4,2:5])
+
+  # uncompressed data written by ourselves
+  data = numpy.arange(60, dtype='int32').reshape(10,6)
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    write_matrix(filename, 'data', data)
+    assert numpy.array_equal(read_slice(filename, 'data', (3,1), (2,1), (4,5)), data[3:10:2,1:6])
+    nose.tools.assert_raises(RuntimeError, read_slice, filename, 'data', (8,0), None, (3,6))
+    nose.tools.assert_raises(ValueError, read_slice, filename, 'data', (0,), None, (1,))
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_mmap():
+
+  # uncompressed data is viewed straight from the file
+  data = numpy.random.normal(size=(30,20,2)).astype('float64')
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    write_matrix(filename, 'data', data, compression=False)
+    mapped = read_matrix(filename, 'data', mmap=True)
+    assert numpy.array_equal(mapped, data)
+    assert mapped.flags.f_contiguous
+    assert not mapped.flags.writeable
+    assert numpy.array_equal(read_matrix(filename, None, True), data)
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+  # compressed data is read as usual
+  filename = test_utils.datafile('test_2d.mat', __name__)
+  x = read_matrix(filename, 'x', mmap=True)
+  assert numpy.array_equal(x, read_matrix(filename, 'x'))
+  assert x.flags.writeable
+
+def test_fortran_order():
+
+  data = numpy.random.normal(size=(7,5,3)) + 1j * numpy.random.normal(size=(7,5,3))
+  for array in (data.real.copy(), data):
+    filename = test_utils.temporary_filename(suffix='.mat')
+    try:
+      write_matrix(filename, 'data', numpy.asfortranarray(array))
+      assert numpy.array_equal(read_matrix(filename, 'data'), array)
+      f = read_matrix(filename, 'data', order='F')
+      assert f.flags.f_contiguous
+      assert numpy.array_equal(f, array)
+      nose.tools.assert_raises(ValueError, read_matrix, filename, 'data', False, 'A')
+    finally:
+      if os.path.exists(filename): os.unlink(filename)
+
+def test_reorder_kernels():
+
+  # shapes which are not multiples of the 4, 8 and 32 element tiles, so both
+  # the vectorized kernels and the scalar remainders are used. Arrays in one
+  # order are written as they are and re-ordered when read in the other, so
+  # each direction is checked against numpy, not against the other one.
+  shapes = [(33,65), (1,67), (67,1), (129,257), (9,17,33), (5,7,9,33)]
+  dtypes = ['float32', 'float64', 'complex64', 'complex128']
+
+  for shape in shapes:
+    for dtype in dtypes:
+      data = numpy.random.normal(size=shape)
+      if dtype.startswith('complex'):
+        data = data + 1j * numpy.random.normal(size=shape)
+      data = data.astype(dtype)
+      filename = test_utils.temporary_filename(suffix='.mat')
+      try:
+        write_matrix(filename, 'c', data)
+        write_matrix(filename, 'f', numpy.asfortranarray(data))
+        for name in ('c', 'f'):
+          for order in ('C', 'F'):
+            read = read_matrix(filename, name, order=order)
+            assert read.dtype == data.dtype
+            assert numpy.array_equal(read, data), \
+                "%s %s array `%s' read in %s order" % (shape, dtype, name, order)
+      finally:
+        if os.path.exists(filename): os.unlink(filename)
+
+def test_many_dimensions():
+
+  data = numpy.random.normal(size=(2,3,4,2,3)).astype('float32')
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    write_matrix(filename, 'data', data)
+    write_matrix(filename, 'fortran', numpy.asfortranarray(data[..., None]))
+    assert numpy.array_equal(read_matrix(filename, 'data'), data)
+    assert numpy.array_equal(read_matrix(filename, 'data', order='F'), data)
+    assert numpy.array_equal(read_matrix(filename, 'fortran'), data[..., None])
+    assert read_vartypes(filename)[0][1] == data.shape
+
+    # bob.io.base only supports up to 4 dimensions
+    nose.tools.assert_raises(RuntimeError, load, filename)
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_struct():
+
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    # dictionaries are written as 1x1 structs
+    data = {'a': numpy.arange(6, dtype='float64').reshape(2,3), 'b': numpy.int32(7)}
+    write_matrix(filename, 'dict', data)
+    got = read_struct(filename, 'dict')
+    assert sorted(got.keys()) == ['a', 'b']
+    assert numpy.array_equal(got['a'], data['a'])
+    assert got['b'].shape == (1,1) and got['b'][0,0] == 7
+    assert list(read_struct(filename, 'dict', ['b']).keys()) == ['b']
+    nose.tools.assert_raises(KeyError, read_struct, filename, 'dict', ['c'])
+
+    # structured arrays, as struct arrays of the same shape
+    records = numpy.zeros((2,3), dtype=[('x', 'float32', (2,)), ('y', 'uint8')])
+    records['x'] = numpy.random.normal(size=(2,3,2))
+    records['y'] = numpy.arange(6).reshape(2,3)
+    write_matrix(filename, 'records', records)
+    got = read_struct(filename, 'records')
+    assert got['x'].shape == (2,3)
+    for i in range(2):
+      for j in range(3):
+        assert numpy.array_equal(got['x'][i,j], records['x'][i,j])
+        assert got['y'][i,j][0,0] == records['y'][i,j]
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_sparse():
+
+  try:
+    import scipy.sparse
+  except ImportError:
+    raise nose.plugins.skip.SkipTest("scipy is not available")
+
+  dense = numpy.zeros((40, 30))
+  dense[[3, 0, 17, 39], [0, 5, 5, 29]] = [1., -2., 3.5, 4.]
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    write_matrix(filename, 'real', scipy.sparse.csr_matrix(dense))
+    write_matrix(filename, 'complex', scipy.sparse.csc_matrix(dense * (1-2j)))
+    got = read_sparse(filename, 'real')
+    assert got.format == 'csc' and got.nnz == 4
+    assert numpy.array_equal(got.toarray(), dense)
+    assert numpy.array_equal(read_sparse(filename, 'complex').toarray(), dense * (1-2j))
+    nose.tools.assert_raises(RuntimeError, read_sparse, test_utils.datafile('test_2d.mat', __name__), 'x')
+
+    # int64 indices, as scipy uses for large matrices, are written if they fit
+    wide = scipy.sparse.csc_matrix(dense)
+    wide.indices = wide.indices.astype('int64')
+    wide.indptr = wide.indptr.astype('int64')
+    write_matrix(filename, 'wide', wide)
+    assert numpy.array_equal(read_sparse(filename, 'wide').toarray(), dense)
+    wide.indices[-1] = 2**40
+    nose.tools.assert_raises(ValueError, write_matrix, filename, 'overflow', wide)
+
+    # matrices that are not valid CSC are rejected, whatever their index type
+    for broken in ('negative', 'row', 'start', 'decreasing'):
+      bad = scipy.sparse.csc_matrix(dense)
+      bad.has_sorted_indices = True
+      if broken == 'negative': bad.indices[0] = -1
+      elif broken == 'row': bad.indices[-1] = dense.shape[0]
+      elif broken == 'start': bad.indptr[0] = 1
+      else: bad.indptr[3] = bad.indptr[-1] + 1
+      nose.tools.assert_raises(ValueError, write_matrix, filename, broken, bad)
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_logical_and_char():
+
+  mask = numpy.random.random_sample((13,7)) > 0.5
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    # logical arrays stay at one byte per element
+    write_matrix(filename, 'mask', mask, compression=False)
+    got = read_matrix(filename, 'mask')
+    assert got.dtype == numpy.bool_
+    assert numpy.array_equal(got, mask)
+    assert read_matrix(filename, 'mask', mmap=True).dtype == numpy.bool_
+    assert read_vartypes(filename)[0][0] == numpy.dtype('bool')
+
+    # char arrays are strings, one per row
+    write_matrix(filename, 'label', u'caf\u00e9 \U0001f600')
+    write_matrix(filename, 'labels', [u'cat', u'horse'])
+    assert read_matrix(filename, 'label') == u'caf\u00e9 \U0001f600'
+    assert read_matrix(filename, 'labels') == [u'cat  ', u'horse']
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def _utf8_char_file(filename, varname, rows):
+  """Writes a version 5 file with a char array stored as UTF-8 (miUTF8),
+  which matio does not write itself"""
+
+  import struct
+
+  def element(type_, data):
+    padding = b'\0' * (-len(data) % 8)
+    return struct.pack('<II', type_, len(data)) + data + padding
+
+  # characters are stored column after column, as any other array
+  columns = u''.join(u''.join(k) for k in zip(*rows))
+  name = varname.encode('ascii')
+  contents = element(6, struct.pack('<II', 4, 0)) + \
+      element(5, struct.pack('<ii', len(rows), len(rows[0].encode('utf-16-le')) // 2)) + \
+      element(1, name) + element(16, columns.encode('utf-8'))
+
+  header = b'MATLAB 5.0 MAT-file'.ljust(116, b' ') + b'\0' * 8 + \
+      struct.pack('<H', 0x0100) + b'IM'
+  with open(filename, 'wb') as f:
+    f.write(header + element(14, contents))
+
+def test_utf8_char():
+
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    _utf8_char_file(filename, 'names', [u'caf\u00e9', u'ni\u00f1o'])
+    assert read_matrix(filename, 'names') == [u'caf\u00e9', u'ni\u00f1o']
+    _utf8_char_file(filename, 'name', [u'\u20ac 5'])
+    assert read_matrix(filename, 'name') == u'\u20ac 5'
+
+    # characters outside of the basic multilingual plane take two elements
+    _utf8_char_file(filename, 'emoji', [u'caf\u00e9 \U0001f600'])
+    assert read_matrix(filename, 'emoji') == u'caf\u00e9 \U0001f600'
+    with MatArchive(filename) as archive:
+      assert archive.shapes()['emoji'] == (1, 7)
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_archive():
+
+  data = numpy.random.normal(size=(4,3,2,2,2)).astype('float32')
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    write_matrix(filename, 'data', data)
+    write_matrix(filename, 'mask', data > 0)
+    write_matrix(filename, 'label', u'experiment')
+    write_matrix(filename, 'params', {'rate': numpy.float64(0.5)})
+
+    with MatArchive(filename) as archive:
+      assert archive.keys() == ['data', 'mask', 'label', 'params']
+      assert list(archive) == archive.keys()
+      assert len(archive) == 4 and 'mask' in archive and 'none' not in archive
+      assert archive.shapes()['data'] == data.shape
+      assert archive.shapes()['label'] == (1, 10)
+      assert archive.dtypes()['mask'] == numpy.dtype('bool')
+      assert archive.dtypes()['label'] is None
+
+      # variables are decoded in any order, as many times as needed
+      assert archive['label'] == u'experiment'
+      assert numpy.array_equal(archive['data'], data)
+      assert numpy.array_equal(archive['mask'], data > 0)
+      assert archive['params']['rate'][0,0] == 0.5
+      assert numpy.array_equal(archive['data'], data)
+      nose.tools.assert_raises(KeyError, archive.__getitem__, 'none')
+
+    nose.tools.assert_raises(ValueError, archive.__getitem__, 'data')
+    nose.tools.assert_raises(ValueError, archive.keys)
+    archive.close()
+
+    cells = MatArchive(test_utils.datafile('test_cell.mat', __name__))['cells']
+    assert numpy.array_equal(cells[1], [[2., 3.]])
+
+    # structs read through the archive share its lock with the other reads
+    from multiprocessing.pool import ThreadPool
+    names = ['params', 'data', 'label'] * 8
+    pool = ThreadPool(4)
+    try:
+      with MatArchive(filename) as archive:
+        for name, got in zip(names, pool.map(archive.__getitem__, names)):
+          if name == 'params': assert got['rate'][0,0] == 0.5
+          elif name == 'data': assert numpy.array_equal(got, data)
+          else: assert got == u'experiment'
+    finally:
+      pool.close()
+      pool.join()
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+  # objects which were not initialized raise instead of crashing
+  empty = MatArchive.__new__(MatArchive)
+  nose.tools.assert_raises(RuntimeError, len, empty)
+  nose.tools.assert_raises(RuntimeError, empty.keys)
+  empty.close()
+
+def test_blocks():
+
+  data = numpy.random.normal(size=(23,4,2)).astype('float32')
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    write_matrix(filename, 'data', data)
+    reader = BlockReader(filename, 'data', 5)
+    assert len(reader) == 5
+    blocks = list(reader)
+    assert [k.shape for k in blocks] == [(5,4,2)]*4 + [(3,4,2)]
+    assert numpy.array_equal(numpy.vstack(blocks), data)
+
+    # compressed variables are read whole on the first block
+    cplx = (data + 1j * data[::-1]).astype('complex64')
+    os.unlink(filename)
+    write_matrix(filename, 'data', cplx, compression=True)
+    blocks = list(BlockReader(filename, 'data', 5))
+    assert [k.shape for k in blocks] == [(5,4,2)]*4 + [(3,4,2)]
+    assert numpy.array_equal(numpy.vstack(blocks), cplx)
+
+    # threads sharing an iterator each get whole, distinct blocks
+    from multiprocessing.pool import ThreadPool
+    data = numpy.random.normal(size=(1001,3)).astype('float64')
+    data[:,0] = numpy.arange(len(data))
+    os.unlink(filename)
+    write_matrix(filename, 'data', data)
+    reader = BlockReader(filename, 'data', 10)
+    pool = ThreadPool(4)
+    try:
+      blocks = pool.map(lambda _: list(reader), range(4))
+    finally:
+      pool.close()
+      pool.join()
+    blocks = sorted(sum(blocks, []), key=lambda k: k[0,0])
+    assert numpy.array_equal(numpy.vstack(blocks), data)
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+  # objects which were not initialized raise instead of crashing
+  reader = BlockReader.__new__(BlockReader)
+  nose.tools.assert_raises(RuntimeError, len, reader)
+  nose.tools.assert_raises(RuntimeError, next, reader)
+
+def test_read_many():
+
+  datafile = test_utils.datafile('test_2d.mat', __name__)
+  x = read_matrix(datafile, 'x')
+  y = read_matrix(datafile, 'y')
+
+  arrays = read_many([(datafile, 'x'), (datafile, 'y')] * 5, num_threads=3)
+  assert len(arrays) == 10
+  for k in range(0, 10, 2):
+    assert numpy.array_equal(arrays[k], x)
+    assert numpy.array_equal(arrays[k+1], y)
+
+  # stacked into a pre-allocated array
+  out = numpy.zeros((4,) + x.shape, dtype=x.dtype)
+  assert read_many([(datafile, 'x')] * 4, num_threads=2, out=out) is out
+  assert numpy.array_equal(out, numpy.array([x] * 4))
+
+  nose.tools.assert_raises(RuntimeError, read_many, [(datafile, 'y')], 1, out[:1])
+  nose.tools.assert_raises(RuntimeError, read_many, [(datafile, 'z')])
+
+def test_read_vectors():
+
+  # vectors are the same in both orders, so they are not re-ordered
+  row = numpy.arange(10, dtype='float32').reshape(1,10)
+  column = numpy.arange(7, dtype='int16').reshape(7,1)
+  filename = test_utils.temporary_filename(suffix='.mat')
+  try:
+    write_matrix(filename, 'row', row)
+    write_matrix(filename, 'column', column)
+    got = read_many([(filename, 'row'), (filename, 'column')])
+    assert numpy.array_equal(got[0], row)
+    assert numpy.array_equal(got[1], column)
+    assert numpy.array_equal(read_matrix(filename, 'column'), column)
+  finally:
+    if os.path.exists(filename): os.unlink(filename)
+
+def test_concurrent_reads():
+
+  # reads release the GIL, so these actually overlap
+  from multiprocessing.pool import ThreadPool
+  names = ['test_2d.mat', 'test_3d.mat', 'test_4d_cplx.mat', 'test.mat']
+  files = [test_utils.datafile(k, __name__) for k in names] * 4
+  expected = [read_matrix(k) for k in files]
+
+  pool = ThreadPool(4)
+  try:
+    for got, ref in zip(pool.map(read_matrix, files), expected):
+      assert numpy.array_equal(got, ref)
+    for got, ref in zip(pool.map(load, files), expected):
+      assert numpy.array_equal(got, ref)
+    assert pool.map(read_varnames, files) == [read_varnames(k) for k in files]
+  finally:
+    pool.close()
+    pool.join()
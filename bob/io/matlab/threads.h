@@ -0,0 +1,97 @@
+/**
+ * @date Fri 16 Oct 16:41:51 2026 UTC
+ *
+ * @brief Threads that are always joined, also if exceptions are thrown
+ */
+
+#ifndef BOB_IO_MATLAB_THREADS_H
+#define BOB_IO_MATLAB_THREADS_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+/**
+ * A group of threads that is joined on destruction. A std::thread that is
+ * destroyed without being joined terminates the program, so none of them is
+ * left unjoined, whatever exception is thrown while starting or running them.
+ *
+ * Exceptions thrown by the functions run in the threads are caught and the
+ * first one is re-thrown by join().
+ */
+class thread_group {
+
+  public: //api
+
+    thread_group() { }
+
+    /**
+     * Joins all threads started, ignoring their exceptions
+     */
+    ~thread_group() { join_all(); }
+
+    /**
+     * Runs f() in a new thread. Returns false if the thread could not be
+     * started, for any reason, in which case f() is not called.
+     */
+    template <typename F> bool start(F f) {
+      try {
+        m_threads.emplace_back();
+      }
+      catch (...) {
+        return false;
+      }
+      try {
+        m_threads.back() = std::thread(&thread_group::run<F>, this, f);
+      }
+      catch (...) {
+        m_threads.pop_back();
+        return false;
+      }
+      return true;
+    }
+
+    /**
+     * Joins all threads started, then re-throws the first exception thrown
+     * by any of them, if any
+     */
+    void join() {
+      join_all();
+      if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = std::exception_ptr();
+        std::rethrow_exception(error);
+      }
+    }
+
+  private: //helpers
+
+    template <typename F> void run(F f) {
+      try {
+        f();
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_error) m_error = std::current_exception();
+      }
+    }
+
+    void join_all() {
+      for (size_t k=0; k<m_threads.size(); ++k)
+        if (m_threads[k].joinable()) m_threads[k].join();
+      m_threads.clear();
+    }
+
+    thread_group(const thread_group&);
+    thread_group& operator= (const thread_group&);
+
+  private: //representation
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex; ///< protects m_error
+    std::exception_ptr m_error; ///< first exception thrown by a thread
+
+};
+
+#endif /* BOB_IO_MATLAB_THREADS_H */
@@ -10,9 +10,19 @@
 
 #include "utils.h"
 
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <atomic>
+#include <boost/shared_array.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/checked_delete.hpp>
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
-#include <bob.io.base/reorder.h>
+#include "reorder.h"
+#include "threads.h"
 
 #if MATIO_MAJOR_VERSION > 1 || (MATIO_MAJOR_VERSION == 1 && MATIO_MINOR_VERSION > 3)
 #define MATIO_1_3_OR_OLDER 0
@@ -20,11 +30,129 @@
 #define MATIO_1_3_OR_OLDER 1
 #endif
 
-boost::shared_ptr<mat_t> make_matfile(const char* filename, int flags) {
+#if MATIO_MAJOR_VERSION > 1 || (MATIO_MAJOR_VERSION == 1 && (MATIO_MINOR_VERSION > 5 || (MATIO_MINOR_VERSION == 5 && MATIO_RELEASE_LEVEL >= 13)))
+#define MATIO_HAS_WRITE_APPEND 1
+#else
+#define MATIO_HAS_WRITE_APPEND 0
+#endif
+
+mat_options::mat_options():
+  compress(false),
+  version(0),
+  chunk(0),
+  threads(1) {
+}
+
+mat_type::mat_type():
+  dtype(bob::io::base::array::t_unknown),
+  shape() {
+}
+
+mat_type::mat_type(const bob::io::base::array::typeinfo& info):
+  dtype(info.dtype),
+  shape(info.shape, info.shape + info.nd) {
+}
+
+size_t mat_type::size() const {
+  if (shape.empty()) return 0;
+  size_t retval = 1;
+  for (size_t k=0; k<shape.size(); ++k) retval *= shape[k];
+  return retval;
+}
+
+size_t mat_type::item_size() const {
+  return bob::io::base::array::getElementSize(dtype);
+}
+
+mat_options& default_options() {
+  static mat_options options;
+  return options;
+}
+
+/**
+ * Serializes all accesses to the HDF5 library, see lock_hdf5()
+ */
+static std::recursive_mutex& hdf5_mutex() {
+  static std::recursive_mutex mutex;
+  return mutex;
+}
+
+bool is_mat73(const char* path) {
+
+  char header[128];
+  std::ifstream file(path, std::ios::binary);
+  if (!file.read(header, sizeof(header))) return false;
+
+  //the version is written in the byte order given by the two last bytes
+  unsigned char hi = header[125], lo = header[124];
+  if (header[126] == 'M' && header[127] == 'I') std::swap(hi, lo);
+  else if (header[126] != 'I' || header[127] != 'M') return false;
+
+  return ((hi << 8) | lo) == 0x0200;
+
+}
+
+bool is_mat73(mat_t* file) {
+# if MATIO_1_3_OR_OLDER == 1
+  return false;
+# else
+  return file && Mat_GetVersion(file) == MAT_FT_MAT73;
+# endif
+}
+
+std::unique_lock<std::recursive_mutex> lock_hdf5(const char* path,
+    int version) {
+  std::unique_lock<std::recursive_mutex> lock(hdf5_mutex(), std::defer_lock);
+  if (version == MAT_FT_MAT73 || is_mat73(path)) lock.lock();
+  return lock;
+}
+
+std::unique_lock<std::recursive_mutex> lock_hdf5(bool mat73) {
+  std::unique_lock<std::recursive_mutex> lock(hdf5_mutex(), std::defer_lock);
+  if (mat73) lock.lock();
+  return lock;
+}
+
+/**
+ * Closes files and frees variables read from them. Both refer to HDF5
+ * resources for v7.3 files, so they are released while holding the HDF5 lock,
+ * as this may happen on any thread.
+ */
+struct mat_closer {
+  void operator() (mat_t* file) {
+    if (!file) return;
+    std::unique_lock<std::recursive_mutex> lock(hdf5_mutex(), std::defer_lock);
+    if (is_mat73(file)) lock.lock();
+    Mat_Close(file);
+  }
+};
+
+struct matvar_freer {
+  bool hdf5;
+  void operator() (matvar_t* matvar) {
+    std::unique_lock<std::recursive_mutex> lock(hdf5_mutex(), std::defer_lock);
+    if (hdf5) lock.lock();
+    Mat_VarFree(matvar);
+  }
+};
+
+static boost::shared_ptr<matvar_t> own_matvar(boost::shared_ptr<mat_t>& file,
+    matvar_t* matvar) {
+  matvar_freer freer = { is_mat73(file.get()) };
+  return boost::shared_ptr<matvar_t>(matvar, freer);
+}
+
+boost::shared_ptr<mat_t> make_matfile(const char* filename, int flags,
+    int version) {
+  //there is no handle to tell the format of the file from yet
+  std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(filename, version);
   if ((flags == MAT_ACC_RDWR) && !boost::filesystem::exists(filename)) {
-    return boost::shared_ptr<mat_t>(Mat_Create(filename, 0), std::ptr_fun(Mat_Close));
+#   if MATIO_1_3_OR_OLDER == 0
+    if (version) return boost::shared_ptr<mat_t>(Mat_CreateVer(filename, 0, (enum mat_ft)version), mat_closer());
+#   endif
+    return boost::shared_ptr<mat_t>(Mat_Create(filename, 0), mat_closer());
   }
-  return boost::shared_ptr<mat_t>(Mat_Open(filename, flags), std::ptr_fun(Mat_Close));
+  return boost::shared_ptr<mat_t>(Mat_Open(filename, flags), mat_closer());
 }
 
 /**
@@ -37,7 +165,7 @@ boost::shared_ptr<mat_t> make_matfile(const char* filename, int flags) {
  */
 static boost::shared_ptr<matvar_t> make_matvar(boost::shared_ptr<mat_t>& file) {
 
-  return boost::shared_ptr<matvar_t>(Mat_VarReadNext(file.get()), std::ptr_fun(Mat_VarFree));
+  return own_matvar(file, Mat_VarReadNext(file.get()));
 
 }
 
@@ -48,7 +176,15 @@ static boost::shared_ptr<matvar_t> make_matvar(boost::shared_ptr<mat_t>& file) {
 static boost::shared_ptr<matvar_t>
 make_matvar_info(boost::shared_ptr<mat_t>& file) {
 
-  return boost::shared_ptr<matvar_t>(Mat_VarReadNextInfo(file.get()), std::ptr_fun(Mat_VarFree));
+  return own_matvar(file, Mat_VarReadNextInfo(file.get()));
+
+}
+
+boost::shared_ptr<matvar_t> read_header(boost::shared_ptr<mat_t> file,
+    const char* varname) {
+
+  if (!varname) return make_matvar_info(file);
+  return own_matvar(file, Mat_VarReadInfo(file.get(), const_cast<char*>(varname)));
 
 }
 
@@ -58,7 +194,7 @@ static boost::shared_ptr<matvar_t> make_matvar(boost::shared_ptr<mat_t>& file,
   if (!varname) {
     throw std::runtime_error("empty variable name - cannot lookup the file this way");
   }
-  return boost::shared_ptr<matvar_t>(Mat_VarRead(file.get(), const_cast<char*>(varname)), std::ptr_fun(Mat_VarFree));
+  return own_matvar(file, Mat_VarRead(file.get(), const_cast<char*>(varname)));
 
 }
 
@@ -67,6 +203,8 @@ static boost::shared_ptr<matvar_t> make_matvar(boost::shared_ptr<mat_t>& file,
  */
 static enum matio_classes mio_class_type (bob::io::base::array::ElementType i) {
   switch (i) {
+    case bob::io::base::array::t_bool:
+      return MAT_C_UINT8;
     case bob::io::base::array::t_int8:
       return MAT_C_INT8;
     case bob::io::base::array::t_int16:
@@ -105,6 +243,8 @@ static enum matio_classes mio_class_type (bob::io::base::array::ElementType i) {
  */
 static enum matio_types mio_data_type (bob::io::base::array::ElementType i) {
   switch (i) {
+    case bob::io::base::array::t_bool:
+      return MAT_T_UINT8;
     case bob::io::base::array::t_int8:
       return MAT_T_INT8;
     case bob::io::base::array::t_int16:
@@ -192,65 +332,255 @@ static bob::io::base::array::ElementType bob_element_type (int mio_type, bool is
   return eltype;
 }
 
-boost::shared_ptr<matvar_t> make_matvar
-(const char* varname, const bob::io::base::array::interface& buf) {
+/**
+ * Returns the ElementType given the matio MAT_C_* class and a flag indicating
+ * if the array is complex or not. Contrary to the data type, the class is
+ * already correct on variable headers: matio may store data using a smaller
+ * type on the file, but always converts it back to the class type on reading.
+ */
+static bob::io::base::array::ElementType bob_class_element_type (int mio_class, bool is_complex) {
+
+  switch(mio_class) {
 
-  const bob::io::base::array::typeinfo& info = buf.type();
-  char* cdata = new char[info.buffer_size()];
-  void* fdata = static_cast<void*>(cdata);
+    case(MAT_C_INT8):
+      return bob_element_type(MAT_T_INT8, is_complex);
+    case(MAT_C_INT16):
+      return bob_element_type(MAT_T_INT16, is_complex);
+    case(MAT_C_INT32):
+      return bob_element_type(MAT_T_INT32, is_complex);
+    case(MAT_C_INT64):
+      return bob_element_type(MAT_T_INT64, is_complex);
+    case(MAT_C_UINT8):
+      return bob_element_type(MAT_T_UINT8, is_complex);
+    case(MAT_C_UINT16):
+      return bob_element_type(MAT_T_UINT16, is_complex);
+    case(MAT_C_UINT32):
+      return bob_element_type(MAT_T_UINT32, is_complex);
+    case(MAT_C_UINT64):
+      return bob_element_type(MAT_T_UINT64, is_complex);
+    case(MAT_C_SINGLE):
+      return bob_element_type(MAT_T_SINGLE, is_complex);
+    case(MAT_C_DOUBLE):
+      return bob_element_type(MAT_T_DOUBLE, is_complex);
+    default:
+      return bob::io::base::array::t_unknown;
+  }
+
+}
+
+/**
+ * Returns the ElementType of the values of a variable, from its class.
+ * Logical arrays are read by matio as uint8 arrays, one byte per element,
+ * which are taken as booleans as they are.
+ */
+static bob::io::base::array::ElementType bob_class_element_type (const matvar_t* matvar) {
+  bob::io::base::array::ElementType eltype = bob_class_element_type(matvar->class_type, matvar->isComplex);
+  if (matvar->isLogical && eltype == bob::io::base::array::t_uint8) return bob::io::base::array::t_bool;
+  return eltype;
+}
+
+/**
+ * Same as above, from the type of the data matio read
+ */
+static bob::io::base::array::ElementType bob_element_type (const matvar_t* matvar) {
+  bob::io::base::array::ElementType eltype = bob_element_type(matvar->data_type, matvar->isComplex);
+  if (matvar->isLogical && eltype == bob::io::base::array::t_uint8) return bob::io::base::array::t_bool;
+  return eltype;
+}
+
+/**
+ * Given a matvar_t object, returns our equivalent bob::io::base::array::typeinfo struct.
+ * This only needs the variable header, so it also works for objects read with
+ * Mat_VarReadNextInfo() or Mat_VarReadInfo(). Variables with more dimensions
+ * than a typeinfo can hold are reported with an unknown type: use
+ * get_var_type() for those.
+ */
+static void get_var_info(boost::shared_ptr<const matvar_t> matvar,
+    bob::io::base::array::typeinfo& info) {
+  if (matvar->rank > BOB_MAX_DIM) {
+    info.reset();
+    return;
+  }
+  info.set(bob_class_element_type(matvar.get()),
+#     if MATIO_1_3_OR_OLDER == 1
+      matvar->rank, matvar->dims);
+#     else
+      (size_t)matvar->rank, matvar->dims);
+#     endif
+}
+
+/**
+ * Same as above, for variables of any number of dimensions
+ */
+static void get_var_type(boost::shared_ptr<const matvar_t> matvar,
+    mat_type& type) {
+  type.dtype = bob_class_element_type(matvar.get());
+  type.shape.assign(matvar->dims, matvar->dims + matvar->rank);
+}
+
+/**
+ * Tells if the row-major and the column-major representations of an array
+ * are the same in memory, which happens if at most one of its dimensions
+ * has more than one element (e.g. 1D arrays, row or column vectors).
+ */
+static bool same_order (const mat_type& type) {
+  size_t non_singleton = 0;
+  for (size_t i=0; i<type.shape.size(); ++i) if (type.shape[i] > 1) ++non_singleton;
+  return non_singleton <= 1;
+}
+
+/**
+ * Copies (real) data read by matio, in column-major order, into dst. The data
+ * is re-ordered to row-major order, unless col_major is set.
+ */
+static void from_col_order (const void* src, void* dst,
+    const mat_type& type, size_t threads, bool col_major) {
+  if (col_major) std::memcpy(dst, src, type.buffer_size());
+  else col_to_row_order(src, dst, type.item_size(), type.shape.size(),
+      &type.shape[0], threads);
+}
+
+/**
+ * Same as above, for split complex data, which is interleaved into dst
+ */
+static void from_col_order_complex (const void* src_re, const void* src_im,
+    void* dst, const mat_type& type, size_t threads, bool col_major) {
+  if (col_major) {
+    //interleaving is re-ordering a 1D array
+    size_t elements = type.size();
+    col_to_row_order_complex(src_re, src_im, dst, type.item_size()/2, 1,
+        &elements, threads);
+  }
+  else col_to_row_order_complex(src_re, src_im, dst, type.item_size()/2,
+      type.shape.size(), &type.shape[0], threads);
+}
+
+/**
+ * Deletes a matvar_t created with MAT_F_DONT_COPY_DATA, while keeping the
+ * data it refers to alive for as long as it is needed
+ */
+struct matvar_deleter {
+
+  boost::shared_array<char> data; ///< staging buffer, if any
+# if MATIO_1_3_OR_OLDER == 1
+  boost::shared_ptr<ComplexSplit> complex;
+# else
+  boost::shared_ptr<mat_complex_split_t> complex;
+# endif
+
+  void operator() (matvar_t* matvar) { Mat_VarFree(matvar); }
+
+};
+
+/**
+ * Creates a new matvar_t to write the array of the given type at ptr. The
+ * returned variable may refer to that memory directly, so it should not
+ * outlive it. Data that needs re-ordering is re-ordered using up to the given
+ * number of threads. If col_major is set, the array is already in
+ * column-major order and only complex data needs to be split.
+ */
+static boost::shared_ptr<matvar_t> make_matvar
+(const char* varname, const mat_type& type, const void* ptr,
+ size_t threads, bool col_major) {
 
-  boost::shared_ptr<matvar_t> retval;
   //matio gets dimensions as integers
 # if MATIO_1_3_OR_OLDER == 1
-  int mio_dims[BOB_MAX_DIM];
+  std::vector<int> mio_dims(type.shape.begin(), type.shape.end());
 # else
-  size_t mio_dims[BOB_MAX_DIM];
+  std::vector<size_t> mio_dims(type.shape.begin(), type.shape.end());
 # endif
-  for (size_t i=0; i<info.nd; ++i) mio_dims[i] = info.shape[i];
 
-  switch (info.dtype) {
+  //matio does not copy the data we hand it: the deleter keeps the (single)
+  //staging buffer alive, if we need one, and the caller keeps buf alive.
+  matvar_deleter deleter;
+  void* data = 0;
+  int flags = MAT_F_DONT_COPY_DATA;
+
+  //logical arrays are uint8 arrays for matio, flagged as such
+  if (type.dtype == bob::io::base::array::t_bool) flags |= MAT_F_LOGICAL;
+
+  switch (type.dtype) {
     case bob::io::base::array::t_complex64:
     case bob::io::base::array::t_complex128:
     case bob::io::base::array::t_complex256:
       {
-        //special treatment for complex arrays
-        uint8_t* real = static_cast<uint8_t*>(fdata);
-        uint8_t* imag = real + (info.buffer_size()/2);
-        bob::io::base::row_to_col_order_complex(buf.ptr(), real, imag, info);
+        //special treatment for complex arrays, matio wants them split
+        deleter.data.reset(new char[type.buffer_size()]);
+        uint8_t* real = reinterpret_cast<uint8_t*>(deleter.data.get());
+        uint8_t* imag = real + (type.buffer_size()/2);
+        if (col_major) {
+          size_t elements = type.size();
+          row_to_col_order_complex(ptr, real, imag, type.item_size()/2, 1,
+              &elements, threads);
+        }
+        else row_to_col_order_complex(ptr, real, imag, type.item_size()/2,
+            type.shape.size(), &type.shape[0], threads);
 #       if MATIO_1_3_OR_OLDER == 1
-        ComplexSplit mio_complex = {real, imag};
+        deleter.complex.reset(new ComplexSplit);
 #       else
-        mat_complex_split_t mio_complex = {real, imag};
+        deleter.complex.reset(new mat_complex_split_t);
 #       endif
-        retval.reset(Mat_VarCreate(varname,
-              mio_class_type(info.dtype), mio_data_type(info.dtype),
-              info.nd, mio_dims, static_cast<void*>(&mio_complex),
-              MAT_F_COMPLEX),
-            std::ptr_fun(Mat_VarFree));
+        deleter.complex->Re = real;
+        deleter.complex->Im = imag;
+        data = static_cast<void*>(deleter.complex.get());
+        flags |= MAT_F_COMPLEX;
       }
+      break;
     default:
+      if (col_major || same_order(type)) {
+        //nothing to re-order, matio can write directly from our buffer
+        data = const_cast<void*>(ptr);
+      }
+      else {
+        deleter.data.reset(new char[type.buffer_size()]);
+        row_to_col_order(ptr, deleter.data.get(), type.item_size(),
+            type.shape.size(), &type.shape[0], threads); ///< data copying!
+        data = static_cast<void*>(deleter.data.get());
+      }
       break;
   }
 
-  if (!retval){
-    bob::io::base::row_to_col_order(buf.ptr(), fdata, info); ///< data copying!
+  return boost::shared_ptr<matvar_t>(Mat_VarCreate(varname,
+        mio_class_type(type.dtype), mio_data_type(type.dtype),
+        mio_dims.size(), &mio_dims[0], data, flags), deleter);
+}
+
+/**
+ * Same as above, for the contents of buf
+ */
+static boost::shared_ptr<matvar_t> make_matvar
+(const char* varname, const bob::io::base::array::interface& buf,
+ size_t threads, bool col_major=false) {
+  return make_matvar(varname, mat_type(buf.type()), buf.ptr(), threads,
+      col_major);
+}
+
+/**
+ * Copies the data of a matvar variable of the given type to dst
+ */
+static void copy_matvar (boost::shared_ptr<matvar_t> matvar,
+    const mat_type& type, void* dst, size_t threads, bool col_major) {
 
-    retval.reset(Mat_VarCreate(varname,
-          mio_class_type(info.dtype), mio_data_type(info.dtype),
-          info.nd, mio_dims, fdata, 0), std::ptr_fun(Mat_VarFree));
+  if (matvar->isComplex) {
+#   if MATIO_1_3_OR_OLDER == 1
+    ComplexSplit mio_complex = *static_cast<ComplexSplit*>(matvar->data);
+#   else
+    mat_complex_split_t mio_complex = *static_cast<mat_complex_split_t*>(matvar->data);
+#   endif
+    from_col_order_complex(mio_complex.Re, mio_complex.Im, dst, type, threads, col_major);
   }
+  else from_col_order(matvar->data, dst, type, threads, col_major);
 
-  delete[] cdata;
-  return retval;
 }
 
 /**
  * Assigns a single matvar variable to an bob::io::base::array::interface. Re-allocates the buffer
  * if required.
  */
-static void assign_array (boost::shared_ptr<matvar_t> matvar, bob::io::base::array::interface& buf) {
+static void assign_array (boost::shared_ptr<matvar_t> matvar, bob::io::base::array::interface& buf,
+    size_t threads, bool col_major) {
 
-  bob::io::base::array::typeinfo info(bob_element_type(matvar->data_type, matvar->isComplex),
+  bob::io::base::array::typeinfo info(bob_element_type(matvar.get()),
 #     if MATIO_1_3_OR_OLDER == 1
       matvar->rank, matvar->dims);
 #     else
@@ -259,20 +589,12 @@ static void assign_array (boost::shared_ptr<matvar_t> matvar, bob::io::base::arr
 
   if(!buf.type().is_compatible(info)) buf.set(info);
 
-  if (matvar->isComplex) {
-#   if MATIO_1_3_OR_OLDER == 1
-    ComplexSplit mio_complex = *static_cast<ComplexSplit*>(matvar->data);
-#   else
-    mat_complex_split_t mio_complex = *static_cast<mat_complex_split_t*>(matvar->data);
-#   endif
-    bob::io::base::col_to_row_order_complex(mio_complex.Re, mio_complex.Im, buf.ptr(), info);
-  }
-  else bob::io::base::col_to_row_order(matvar->data, buf.ptr(), info);
+  copy_matvar(matvar, mat_type(info), buf.ptr(), threads, col_major);
 
 }
 
 void read_array (boost::shared_ptr<mat_t> file, bob::io::base::array::interface& buf,
-    const char* varname) {
+    const char* varname, size_t threads, bool col_major) {
 
   boost::shared_ptr<matvar_t> matvar;
   if (varname) matvar = make_matvar(file, varname);
@@ -282,116 +604,1230 @@ void read_array (boost::shared_ptr<mat_t> file, bob::io::base::array::interface&
     m % varname;
     throw std::runtime_error(m.str());
   }
-  assign_array(matvar, buf);
+  assign_array(matvar, buf, threads, col_major);
 
 }
 
-void write_array(boost::shared_ptr<mat_t> file,
-    const char* varname, const bob::io::base::array::interface& buf) {
+/**
+ * Reads the data of a variable of the given type from its header only, to
+ * dst. Returns false if matio cannot do it.
+ */
+static bool read_data (boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, const mat_type& type, void* dst,
+    size_t threads, bool col_major) {
 
-  boost::shared_ptr<matvar_t> matvar = make_matvar(varname, buf);
-# if MATIO_1_3_OR_OLDER == 1
-  Mat_VarWrite(file.get(), matvar.get(), 0);
-# else
-  Mat_VarWrite(file.get(), matvar.get(), (matio_compression)0);
-# endif
+  //matio counts elements using integers
+  size_t elements = type.size();
+  if (elements == 0 || elements > INT_MAX) return false;
+
+  boost::shared_array<char> data;
+  bool in_place = !header->isComplex && (col_major || same_order(type));
+  if (!in_place) data.reset(new char[type.buffer_size()]);
+  int status;
+  if (header->isComplex) {
+#   if MATIO_1_3_OR_OLDER == 1
+    ComplexSplit mio_complex = {data.get(), data.get() + (type.buffer_size()/2)};
+#   else
+    mat_complex_split_t mio_complex = {data.get(), data.get() + (type.buffer_size()/2)};
+#   endif
+    status = Mat_VarReadDataLinear(file.get(), header.get(), &mio_complex,
+        0, 1, elements);
+    if (status == 0) from_col_order_complex(mio_complex.Re, mio_complex.Im, dst, type, threads, col_major);
+  }
+  else if (in_place) {
+    //already in the right order, matio can read directly into our buffer
+    status = Mat_VarReadDataLinear(file.get(), header.get(), dst,
+        0, 1, elements);
+  }
+  else {
+    status = Mat_VarReadDataLinear(file.get(), header.get(), data.get(),
+        0, 1, elements);
+    if (status == 0) from_col_order(data.get(), dst, type, threads, false);
+  }
+  return status == 0;
 
 }
 
-/**
- * Given a matvar_t object, returns our equivalent bob::io::base::array::typeinfo struct.
- */
-static void get_var_info(boost::shared_ptr<const matvar_t> matvar,
-    bob::io::base::array::typeinfo& info) {
-  info.set(bob_element_type(matvar->data_type, matvar->isComplex),
+void read_array (boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, bob::io::base::array::interface& buf,
+    size_t threads, bool col_major) {
+
+  bob::io::base::array::typeinfo info(bob_class_element_type(header.get()),
 #     if MATIO_1_3_OR_OLDER == 1
-      matvar->rank, matvar->dims);
+      header->rank, header->dims);
 #     else
-      (size_t)matvar->rank, matvar->dims);
+      (size_t)header->rank, header->dims);
 #     endif
+
+  if (info.dtype == bob::io::base::array::t_unknown) {
+    boost::format m("unsupported data type while reading object `%s'");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+  if(!buf.type().is_compatible(info)) buf.set(info);
+
+  if (read_data(file, header, mat_type(info), buf.ptr(), threads, col_major)) return;
+
+  //matio cannot read this variable from its header only, search for it
+  read_array(file, buf, header->name, threads, col_major);
+
 }
 
-void mat_peek(const char* filename, bob::io::base::array::typeinfo& info, const char* varname) {
+/**
+ * Tells if a variable that was read (with its data) has the given type
+ */
+static bool has_type (boost::shared_ptr<matvar_t> matvar, const mat_type& type) {
+  if (!matvar || !matvar->data) return false;
+  mat_type found;
+  found.dtype = bob_element_type(matvar.get());
+  found.shape.assign(matvar->dims, matvar->dims + matvar->rank);
+  return found.dtype == type.dtype && found.shape == type.shape;
+}
 
-  boost::shared_ptr<mat_t> mat = make_matfile(filename, MAT_ACC_RDONLY);
-  if (!mat) {
-    boost::format m("cannot open file `%s'");
-    m % filename;
+void read_array (boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, const mat_type& type, void* dst,
+    size_t threads, bool col_major) {
+
+  if (type.dtype == bob::io::base::array::t_unknown) {
+    boost::format m("unsupported data type while reading object `%s'");
+    m % header->name;
     throw std::runtime_error(m.str());
   }
-  boost::shared_ptr<matvar_t> matvar = varname ? make_matvar(mat,varname) : make_matvar(mat); //gets the given variable name
-  if (!matvar) {
-    if (varname){
-      boost::format m("Cannot locate variable `%s' in file '%s'");
-      m % varname % filename;
-      throw std::runtime_error(m.str());
-    }else{
-      boost::format m("Cannot find any variable in file '%s'");
-      m % filename;
-      throw std::runtime_error(m.str());
-    }
+
+  if (read_data(file, header, type, dst, threads, col_major)) return;
+
+  //matio cannot read this variable from its header only, search for it
+  boost::shared_ptr<matvar_t> matvar = make_matvar(file, header->name);
+  if (!has_type(matvar, type)) {
+    boost::format m("mat file variable could not be created - error while reading object `%s'");
+    m % header->name;
+    throw std::runtime_error(m.str());
   }
-  get_var_info(matvar, info);
+  copy_matvar(matvar, type, dst, threads, col_major);
 
 }
 
-void mat_peek_set(const char* filename, bob::io::base::array::typeinfo& info, const char* varname) {
-  boost::shared_ptr<mat_t> mat = make_matfile(filename, MAT_ACC_RDONLY);
-  if (!mat) {
-    boost::format m("cannot open file `%s'");
-    m % filename;
+void read_slice (boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, const size_t* start,
+    const size_t* stride, const size_t* count,
+    bob::io::base::array::interface& buf) {
+
+  bob::io::base::array::typeinfo info;
+  info.dtype = bob_class_element_type(header.get());
+  if (info.dtype == bob::io::base::array::t_unknown) {
+    boost::format m("unsupported data type while reading object `%s'");
+    m % header->name;
     throw std::runtime_error(m.str());
   }
-  boost::shared_ptr<matvar_t> matvar = varname ? make_matvar(mat,varname) : make_matvar(mat); //gets the first var.
-  if (!matvar) {
-    if (varname){
-      boost::format m("Cannot locate variable `%s' in file '%s'");
-      m % varname % filename;
+
+  if (header->rank > BOB_MAX_DIM) {
+    boost::format m("number of dimensions for object `%s' (%d) exceeds the maximum supported (%d)");
+    m % header->name % header->rank % BOB_MAX_DIM;
+    throw std::runtime_error(m.str());
+  }
+
+  //matio addresses the data using integers
+  int mio_start[BOB_MAX_DIM];
+  int mio_stride[BOB_MAX_DIM];
+  int mio_edge[BOB_MAX_DIM];
+  for (int i=0; i<header->rank; ++i) {
+    if (count[i] == 0 || stride[i] == 0 ||
+        (start[i] + (count[i]-1)*stride[i]) >= (size_t)header->dims[i]) {
+      boost::format m("slice with start=%u, stride=%u and count=%u is out of range for dimension %d of object `%s', which has %u elements");
+      m % start[i] % stride[i] % count[i] % i % header->name % header->dims[i];
       throw std::runtime_error(m.str());
-    }else{
-      boost::format m("Cannot find any variable in file '%s'");
-      m % filename;
+    }
+    if (start[i] > INT_MAX || stride[i] > INT_MAX || count[i] > INT_MAX) {
+      boost::format m("slice with start=%u, stride=%u and count=%u cannot be read from dimension %d of object `%s': matio only addresses up to %d elements per dimension");
+      m % start[i] % stride[i] % count[i] % i % header->name % INT_MAX;
       throw std::runtime_error(m.str());
     }
+    mio_start[i] = start[i];
+    mio_stride[i] = stride[i];
+    mio_edge[i] = count[i];
   }
-  get_var_info(matvar, info);
-}
+  info.set_shape<size_t>(header->rank, count);
 
-boost::shared_ptr<std::map<size_t, std::pair<std::string, bob::io::base::array::typeinfo> > >
-list_variables(const char* filename) {
+  if(!buf.type().is_compatible(info)) buf.set(info);
 
-  boost::shared_ptr<std::map<size_t, std::pair<std::string, bob::io::base::array::typeinfo> > > retval(new std::map<size_t, std::pair<std::string, bob::io::base::array::typeinfo> >());
+  //matio decodes the slice in column-major order, which we then re-order
+  boost::shared_array<char> data(new char[info.buffer_size()]);
+  int status;
+  if (header->isComplex) {
+#   if MATIO_1_3_OR_OLDER == 1
+    ComplexSplit mio_complex = {data.get(), data.get() + (info.buffer_size()/2)};
+#   else
+    mat_complex_split_t mio_complex = {data.get(), data.get() + (info.buffer_size()/2)};
+#   endif
+    status = Mat_VarReadData(file.get(), header.get(), &mio_complex,
+        mio_start, mio_stride, mio_edge);
+    if (status == 0) col_to_row_order_complex(mio_complex.Re, mio_complex.Im, buf.ptr(), info);
+  }
+  else {
+    status = Mat_VarReadData(file.get(), header.get(), data.get(),
+        mio_start, mio_stride, mio_edge);
+    if (status == 0) col_to_row_order(data.get(), buf.ptr(), info);
+  }
 
-  boost::shared_ptr<mat_t> mat = make_matfile(filename, MAT_ACC_RDONLY);
-  if (!mat) {
-    boost::format m("cannot open file `%s'");
-    m % filename;
+  if (status != 0) {
+    boost::format m("error while reading a slice of object `%s' (matio cannot read slices of this kind of variable)");
+    m % header->name;
     throw std::runtime_error(m.str());
   }
-  boost::shared_ptr<matvar_t> matvar = make_matvar(mat); //gets the first var.
 
-  size_t id = 0;
+}
 
-  //now that we have found a variable, fill the array
-  //properties taking that variable as basis
-  (*retval)[id] = std::make_pair(matvar->name, bob::io::base::array::typeinfo());
-  get_var_info(matvar, (*retval)[id].second);
-  const bob::io::base::array::typeinfo& type_cache = (*retval)[id].second;
+const size_t mat_block_reader::MAX_INFLATED_BYTES = 1 << 30;
 
-  if ((*retval)[id].second.dtype == bob::io::base::array::t_unknown) {
-    boost::format m("unknown data type (%s) for object named `%s' at file `%s'");
-    m % (*retval)[id].second.str() % id % filename;
+mat_block_reader::mat_block_reader(boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, size_t rows, size_t threads):
+  m_file(file),
+  m_header(header),
+  m_rows(rows),
+  m_row(0),
+  m_threads(threads)
+{
+  if (!rows) throw std::runtime_error("blocks must have at least one row");
+  get_var_info(header, m_type);
+  if (m_type.dtype == bob::io::base::array::t_unknown) {
+    boost::format m("unsupported data type while reading object `%s'");
+    m % header->name;
     throw std::runtime_error(m.str());
   }
+}
 
-  //if we got here, just continue counting the variables inside. we
-  //only read their info since that is faster -- but attention! if we just read
-  //the varinfo, we don't get typing correct, so we copy that from the previous
-  //read variable and hope for the best.
+size_t mat_block_reader::size() const {
+  return (m_type.shape[0] + m_rows - 1) / m_rows;
+}
 
-  while ((matvar = make_matvar_info(mat))) {
-    (*retval)[++id] = std::make_pair(matvar->name, type_cache);
+void mat_block_reader::next_type(bob::io::base::array::typeinfo& info) const {
+  info = m_type;
+  info.shape[0] = done() ? 0 : std::min(m_rows, m_type.shape[0] - m_row);
+  info.update_strides();
+}
+
+/**
+ * Copies rows [row, row+count) of a column-major array of the given number of
+ * rows and columns (all other dimensions taken together), to a column-major
+ * array of count rows
+ */
+static void copy_rows(const void* src, void* dst, size_t elsize,
+    size_t rows, size_t columns, size_t row, size_t count) {
+  const char* from = static_cast<const char*>(src) + row*elsize;
+  char* to = static_cast<char*>(dst);
+  for (size_t j=0; j<columns; ++j) {
+    std::memcpy(to + j*count*elsize, from + j*rows*elsize, count*elsize);
   }
+}
+
+bool mat_block_reader::read(bob::io::base::array::interface& buf) {
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (done()) return false;
+
+  bob::io::base::array::typeinfo info;
+  next_type(info);
+
+  //we keep the file open between blocks, so we lock it ourselves
+  std::unique_lock<std::recursive_mutex> hdf5(hdf5_mutex(), std::defer_lock);
+  if (is_mat73(m_file.get())) hdf5.lock();
+
+# if MATIO_1_3_OR_OLDER == 0
+  if (m_header->compression != MAT_COMPRESSION_NONE &&
+      m_type.buffer_size() <= MAX_INFLATED_BYTES) {
+    if (!m_whole) {
+      m_whole = make_matvar(m_file, m_header->name);
+      if (!has_type(m_whole, mat_type(m_type))) {
+        m_whole.reset();
+        boost::format m("mat file variable could not be created - error while reading object `%s'");
+        m % m_header->name;
+        throw std::runtime_error(m.str());
+      }
+    }
+
+    if(!buf.type().is_compatible(info)) buf.set(info);
+
+    //the rows of the block are gathered, then re-ordered as any other array
+    mat_type block(info);
+    const size_t rows = m_type.shape[0];
+    const size_t columns = mat_type(m_type).size() / rows;
+    if (m_whole->isComplex) {
+      const mat_complex_split_t* split =
+        static_cast<const mat_complex_split_t*>(m_whole->data);
+      const size_t elsize = block.item_size() / 2;
+      boost::shared_array<char> re(new char[block.size() * elsize]);
+      boost::shared_array<char> im(new char[block.size() * elsize]);
+      copy_rows(split->Re, re.get(), elsize, rows, columns, m_row, info.shape[0]);
+      copy_rows(split->Im, im.get(), elsize, rows, columns, m_row, info.shape[0]);
+      from_col_order_complex(re.get(), im.get(), buf.ptr(), block, m_threads, false);
+    }
+    else {
+      boost::shared_array<char> data(new char[block.buffer_size()]);
+      copy_rows(m_whole->data, data.get(), block.item_size(), rows, columns,
+          m_row, info.shape[0]);
+      from_col_order(data.get(), buf.ptr(), block, m_threads, false);
+    }
+
+    m_row += info.shape[0];
+    if (done()) m_whole.reset(); ///< releases memory after the last block
+    return true;
+  }
+# endif
+
+  std::vector<size_t> start(info.nd, 0);
+  std::vector<size_t> stride(info.nd, 1);
+  start[0] = m_row;
+  read_slice(m_file, m_header, &start[0], &stride[0], info.shape, buf);
+  m_row += info.shape[0];
+  return true;
+
+}
+
+mat_struct_reader::mat_struct_reader(boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, boost::shared_ptr<std::mutex> mutex):
+  m_file(file),
+  m_header(header),
+  m_lazy(false),
+  m_mutex(mutex ? mutex : boost::make_shared<std::mutex>())
+{
+  if (header->class_type != MAT_C_STRUCT) {
+    boost::format m("object `%s' is not a struct");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+# if MATIO_1_3_OR_OLDER == 1
+  throw std::runtime_error("reading structs requires matio 1.5 or newer");
+# else
+  char* const* names = Mat_VarGetStructFieldnames(header.get());
+  unsigned nfields = Mat_VarGetNumberOfFields(header.get());
+  if (names) m_fields.assign(names, names + nfields);
+  m_shape.assign(header->dims, header->dims + header->rank);
+
+  //matio only records where the data of each field starts for uncompressed
+  //v5 files; otherwise, the whole struct is read on the first access
+  m_lazy = Mat_GetVersion(file.get()) == MAT_FT_MAT5 &&
+    header->compression == MAT_COMPRESSION_NONE;
+# endif
+}
+
+size_t mat_struct_reader::size() const {
+  size_t retval = 1;
+  for (size_t k=0; k<m_shape.size(); ++k) retval *= m_shape[k];
+  return retval;
+}
+
+void mat_struct_reader::type(const std::string& field, size_t index,
+    mat_type& type) const {
+
+  type = mat_type();
+# if MATIO_1_3_OR_OLDER == 0
+  matvar_t* value = Mat_VarGetStructFieldByName(m_header.get(),
+      field.c_str(), index);
+  if (value) get_var_type(boost::shared_ptr<matvar_t>(m_header, value), type);
+# endif
+
+}
+
+void mat_struct_reader::read(const std::string& field, size_t index,
+    const mat_type& type, void* dst, bool col_major) {
+
+  if (type.size() == 0) return; ///< nothing to read
+
+# if MATIO_1_3_OR_OLDER == 0
+  //field values belong to the struct they were read from
+  boost::shared_ptr<matvar_t> value(m_header,
+      Mat_VarGetStructFieldByName(m_header.get(), field.c_str(), index));
+  if (!value) {
+    boost::format m("struct `%s' has no field `%s' at index %u");
+    m % m_header->name % field % index;
+    throw std::runtime_error(m.str());
+  }
+
+  std::lock_guard<std::mutex> lock(*m_mutex);
+
+  //we keep the file open between fields, so we lock it ourselves
+  std::unique_lock<std::recursive_mutex> hdf5(hdf5_mutex(), std::defer_lock);
+  if (is_mat73(m_file.get())) hdf5.lock();
+
+  if (m_lazy && read_data(m_file, value, type, dst, 1, col_major)) return;
+
+  if (!m_whole) m_whole = make_matvar(m_file, m_header->name);
+  if (m_whole) value = boost::shared_ptr<matvar_t>(m_whole,
+      Mat_VarGetStructFieldByName(m_whole.get(), field.c_str(), index));
+  if (!m_whole || !has_type(value, type)) {
+    boost::format m("cannot read field `%s' of struct `%s' at index %u");
+    m % field % m_header->name % index;
+    throw std::runtime_error(m.str());
+  }
+  copy_matvar(value, type, dst, 1, col_major);
+# endif
+
+}
+
+mat_cell_reader::mat_cell_reader(boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, boost::shared_ptr<std::mutex> mutex):
+  m_file(file),
+  m_header(header),
+  m_whole(new whole_variable()),
+  m_lazy(false)
+{
+  m_whole->mutex = mutex ? mutex : boost::make_shared<std::mutex>();
+
+  if (header->class_type != MAT_C_CELL) {
+    boost::format m("object `%s' is not a cell array");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+# if MATIO_1_3_OR_OLDER == 1
+  throw std::runtime_error("reading cell arrays requires matio 1.5 or newer");
+# else
+  m_shape.assign(header->dims, header->dims + header->rank);
+
+  //as for structs, matio only records where the data of each element starts
+  //for uncompressed v5 files
+  m_lazy = Mat_GetVersion(file.get()) == MAT_FT_MAT5 &&
+    header->compression == MAT_COMPRESSION_NONE;
+# endif
+}
+
+mat_cell_reader::mat_cell_reader(const mat_cell_reader& parent,
+    size_t index):
+  m_file(parent.m_file),
+  m_header(parent.m_header),
+  m_path(parent.m_path),
+  m_whole(parent.m_whole),
+  m_lazy(parent.m_lazy)
+{
+  matvar_t* cell = parent.element(m_header.get(), index);
+  if (!cell || cell->class_type != MAT_C_CELL) {
+    boost::format m("element %u of cell array `%s' is not a cell array");
+    m % index % m_header->name;
+    throw std::runtime_error(m.str());
+  }
+  m_path.push_back(index);
+  m_shape.assign(cell->dims, cell->dims + cell->rank);
+}
+
+size_t mat_cell_reader::size() const {
+  size_t retval = 1;
+  for (size_t k=0; k<m_shape.size(); ++k) retval *= m_shape[k];
+  return retval;
+}
+
+matvar_t* mat_cell_reader::element(matvar_t* root, size_t index) const {
+  if (index >= size()) return 0;
+  matvar_t* cell = root;
+  for (size_t k=0; cell && k<m_path.size(); ++k) {
+    cell = Mat_VarGetCell(cell, m_path[k]);
+  }
+  return cell ? Mat_VarGetCell(cell, index) : 0;
+}
+
+bool mat_cell_reader::is_cell(size_t index) const {
+  matvar_t* value = element(m_header.get(), index);
+  return value && value->class_type == MAT_C_CELL;
+}
+
+boost::shared_ptr<mat_cell_reader> mat_cell_reader::cell(size_t index) const {
+  return boost::shared_ptr<mat_cell_reader>(new mat_cell_reader(*this, index));
+}
+
+void mat_cell_reader::type(size_t index, mat_type& type) const {
+
+  type = mat_type();
+  matvar_t* value = element(m_header.get(), index);
+  if (value) get_var_type(boost::shared_ptr<matvar_t>(m_header, value), type);
+
+}
+
+void mat_cell_reader::read(size_t index, const mat_type& type, void* dst,
+    bool col_major) {
+
+  if (type.size() == 0) return; ///< nothing to read
+
+  //elements belong to the cell array they were read from
+  boost::shared_ptr<matvar_t> value(m_header, element(m_header.get(), index));
+  if (!value) {
+    boost::format m("cell array `%s' has no element at index %u");
+    m % m_header->name % index;
+    throw std::runtime_error(m.str());
+  }
+
+  std::lock_guard<std::mutex> lock(*m_whole->mutex);
+
+  //we keep the file open between elements, so we lock it ourselves
+  std::unique_lock<std::recursive_mutex> hdf5(hdf5_mutex(), std::defer_lock);
+  if (is_mat73(m_file.get())) hdf5.lock();
+
+  if (m_lazy && read_data(m_file, value, type, dst, 1, col_major)) return;
+
+  boost::shared_ptr<matvar_t>& whole = m_whole->matvar;
+  if (!whole) whole = make_matvar(m_file, m_header->name);
+  if (whole) value = boost::shared_ptr<matvar_t>(whole,
+      element(whole.get(), index));
+  if (!whole || !has_type(value, type)) {
+    boost::format m("cannot read element %u of cell array `%s'");
+    m % index % m_header->name;
+    throw std::runtime_error(m.str());
+  }
+  copy_matvar(value, type, dst, 1, col_major);
+
+}
+
+/**
+ * A read-only view to (part of) the memory of another array, used to write
+ * arrays by blocks of rows
+ */
+class array_view: public bob::io::base::array::interface {
+
+  public: //api
+
+    array_view(const void* ptr, const bob::io::base::array::typeinfo& info):
+      m_type(info), m_ptr(const_cast<void*>(ptr)) { }
+
+    virtual ~array_view() { }
+
+    virtual void set(const interface&) {
+      throw std::runtime_error("array views cannot be re-assigned");
+    }
+
+    virtual void set(boost::shared_ptr<interface>) {
+      throw std::runtime_error("array views cannot be re-assigned");
+    }
+
+    virtual void set (const bob::io::base::array::typeinfo&) {
+      throw std::runtime_error("array views cannot be re-allocated");
+    }
+
+    virtual const bob::io::base::array::typeinfo& type() const { return m_type; }
+
+    virtual void* ptr() { return m_ptr; }
+    virtual const void* ptr() const { return m_ptr; }
+
+    virtual boost::shared_ptr<void> owner() { return boost::shared_ptr<void>(); }
+    virtual boost::shared_ptr<const void> owner() const { return boost::shared_ptr<const void>(); }
+
+  private: //representation
+
+    bob::io::base::array::typeinfo m_type;
+    void* m_ptr;
+
+};
+
+#if MATIO_HAS_WRITE_APPEND == 1
+/**
+ * Writes an array to a v7.3 file by blocks of rows. HDF5 creates the
+ * variable with chunks as large as the first block, which allows for
+ * partial reads and writes of arrays larger than 2 GB.
+ */
+static void write_chunked(boost::shared_ptr<mat_t> file, const char* varname,
+    const bob::io::base::array::interface& buf, const mat_options& options) {
+
+  const bob::io::base::array::typeinfo& info = buf.type();
+  const char* data = static_cast<const char*>(buf.ptr());
+  size_t row_size = info.buffer_size() / info.shape[0];
+
+  bob::io::base::array::typeinfo block(info);
+  for (size_t row = 0; row < info.shape[0]; row += options.chunk) {
+    block.shape[0] = std::min(options.chunk, info.shape[0] - row);
+    block.update_strides();
+    array_view view(data + row*row_size, block);
+    boost::shared_ptr<matvar_t> matvar = make_matvar(varname, view, options.threads);
+    int status = Mat_VarWriteAppend(file.get(), matvar.get(),
+        options.compress ? MAT_COMPRESSION_ZLIB : MAT_COMPRESSION_NONE, 1);
+    if (status != 0) {
+      boost::format m("error while writing rows %u to %u of object `%s' to matlab file");
+      m % row % (row + block.shape[0]) % varname;
+      throw std::runtime_error(m.str());
+    }
+  }
+
+}
+#endif
+
+void write_array(boost::shared_ptr<mat_t> file,
+    const char* varname, const bob::io::base::array::interface& buf,
+    const mat_options& options, bool col_major) {
+
+  const bob::io::base::array::typeinfo& info = buf.type();
+
+# if MATIO_HAS_WRITE_APPEND == 1
+  //rows of a column-major array are not contiguous, so it cannot be chunked
+  if (!col_major && options.chunk && info.nd && info.shape[0] > options.chunk &&
+      Mat_GetVersion(file.get()) == MAT_FT_MAT73) {
+    write_chunked(file, varname, buf, options);
+    return;
+  }
+# endif
+
+  write_array(file, varname, mat_type(info), buf.ptr(), options, col_major);
+
+}
+
+void write_array(boost::shared_ptr<mat_t> file, const char* varname,
+    const mat_type& type, const void* ptr, const mat_options& options,
+    bool col_major) {
+
+  boost::shared_ptr<matvar_t> matvar = make_matvar(varname, type, ptr,
+      options.threads, col_major);
+# if MATIO_1_3_OR_OLDER == 1
+  int status = Mat_VarWrite(file.get(), matvar.get(), options.compress ? 1 : 0);
+# else
+  int status = Mat_VarWrite(file.get(), matvar.get(),
+      options.compress ? MAT_COMPRESSION_ZLIB : MAT_COMPRESSION_NONE);
+# endif
+
+  if (status != 0) {
+    boost::format m("error while writing object `%s' to matlab file%s");
+    m % varname % (options.compress ? " (is matio compiled with zlib support?)" : "");
+    throw std::runtime_error(m.str());
+  }
+
+}
+
+#if MATIO_1_3_OR_OLDER == 0
+/**
+ * Frees a struct created to be written. Its field values are freed by their
+ * own deleters, which keep the data they refer to alive, not by matio.
+ */
+struct struct_deleter {
+
+  std::vector<boost::shared_ptr<matvar_t> > values;
+
+  void operator() (matvar_t* matvar) {
+    if (!matvar) return;
+    matvar_t** fields = static_cast<matvar_t**>(matvar->data);
+    size_t n = matvar->nbytes / sizeof(matvar_t*);
+    for (size_t k=0; k<n; ++k) fields[k] = 0;
+    Mat_VarFree(matvar);
+  }
+
+};
+#endif
+
+void write_struct(boost::shared_ptr<mat_t> file, const char* varname,
+    const std::vector<size_t>& shape, const std::vector<std::string>& fields,
+    const std::vector<mat_type>& types, const std::vector<const void*>& data,
+    const mat_options& options) {
+
+# if MATIO_1_3_OR_OLDER == 1
+  throw std::runtime_error("writing structs requires matio 1.5 or newer");
+# else
+  size_t elements = 1;
+  for (size_t k=0; k<shape.size(); ++k) elements *= shape[k];
+
+  //matio names the values after their fields
+  struct_deleter deleter;
+  deleter.values.reserve(types.size());
+  for (size_t k=0; k<types.size(); ++k) {
+    deleter.values.push_back(make_matvar(0, types[k], data[k],
+          options.threads, false));
+  }
+
+  std::vector<const char*> names;
+  for (size_t f=0; f<fields.size(); ++f) names.push_back(fields[f].c_str());
+  std::vector<size_t> dims(shape);
+  boost::shared_ptr<matvar_t> matvar(Mat_VarCreateStruct(varname,
+        dims.size(), &dims[0], names.empty() ? 0 : &names[0], names.size()),
+      deleter);
+  if (!matvar) {
+    boost::format m("cannot create struct `%s'");
+    m % varname;
+    throw std::runtime_error(m.str());
+  }
+
+  for (size_t f=0; f<fields.size(); ++f) {
+    for (size_t k=0; k<elements; ++k) {
+      Mat_VarSetStructFieldByIndex(matvar.get(), f, k,
+          deleter.values[f*elements + k].get());
+    }
+  }
+
+  int status = Mat_VarWrite(file.get(), matvar.get(),
+      options.compress ? MAT_COMPRESSION_ZLIB : MAT_COMPRESSION_NONE);
+  if (status != 0) {
+    boost::format m("error while writing struct `%s' to matlab file");
+    m % varname;
+    throw std::runtime_error(m.str());
+  }
+# endif
+
+}
+
+mat_sparse::mat_sparse():
+  dtype(bob::io::base::array::t_unknown),
+  rows(0),
+  cols(0),
+  nnz(0) {
+}
+
+#if MATIO_1_3_OR_OLDER == 0
+//matio uses 32-bit integers for indices, signed or not depending on its
+//version, which are the same for the (positive) values they hold
+static_assert(sizeof(*mat_sparse_t().ir) == sizeof(int32_t),
+    "matio sparse indices should be 32-bit integers");
+
+/**
+ * Deletes a sparse matvar_t refering to indices and values it does not own
+ */
+struct sparse_deleter {
+  void operator() (matvar_t* matvar) {
+    if (!matvar) return;
+    matvar->data = 0;
+    Mat_VarFree(matvar);
+  }
+};
+#endif
+
+void read_sparse(boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, mat_sparse& sparse) {
+
+  if (header->class_type != MAT_C_SPARSE) {
+    boost::format m("object `%s' is not a sparse matrix");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+# if MATIO_1_3_OR_OLDER == 1
+  throw std::runtime_error("reading sparse matrices requires matio 1.5 or newer");
+# else
+  boost::shared_ptr<matvar_t> matvar = make_matvar(file, header->name);
+  if (!matvar || !matvar->data || matvar->rank != 2) {
+    boost::format m("cannot read sparse matrix `%s'");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+  const mat_sparse_t* s = static_cast<const mat_sparse_t*>(matvar->data);
+  sparse.dtype = bob_element_type(matvar->data_type, matvar->isComplex);
+  sparse.rows = matvar->dims[0];
+  sparse.cols = matvar->dims[1];
+  sparse.nnz = (s->njc > 0) ? s->jc[s->njc-1] : 0;
+
+  if ((sparse.dtype != bob::io::base::array::t_float64 &&
+        sparse.dtype != bob::io::base::array::t_complex128) ||
+      (size_t)s->njc != sparse.cols + 1 || (size_t)s->nir < sparse.nnz ||
+      (size_t)s->ndata < sparse.nnz) {
+    boost::format m("unsupported contents for sparse matrix `%s'");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+  //the indices (and real values) stay with the variable matio read
+  sparse.indices = boost::shared_ptr<const int32_t>(matvar,
+      reinterpret_cast<const int32_t*>(s->ir));
+  sparse.indptr = boost::shared_ptr<const int32_t>(matvar,
+      reinterpret_cast<const int32_t*>(s->jc));
+
+  if (sparse.dtype == bob::io::base::array::t_float64) {
+    sparse.data = boost::shared_ptr<const void>(matvar, s->data);
+  }
+  else {
+    //complex values are split, so they are interleaved
+    const mat_complex_split_t* c = static_cast<const mat_complex_split_t*>(s->data);
+    boost::shared_ptr<std::vector<double> > values =
+      boost::make_shared<std::vector<double> >(2*sparse.nnz);
+    col_to_row_order_complex(c->Re, c->Im, values->data(), sizeof(double), 1,
+        &sparse.nnz, 1);
+    sparse.data = boost::shared_ptr<const void>(values, values->data());
+  }
+# endif
+
+}
+
+void write_sparse(boost::shared_ptr<mat_t> file, const char* varname,
+    const mat_sparse& sparse, const mat_options& options) {
+
+# if MATIO_1_3_OR_OLDER == 1
+  throw std::runtime_error("writing sparse matrices requires matio 1.5 or newer");
+# else
+  if (sparse.dtype != bob::io::base::array::t_float64 &&
+      sparse.dtype != bob::io::base::array::t_complex128) {
+    boost::format m("cannot write sparse matrix `%s' of type %s - only float64 and complex128 are supported");
+    m % varname % bob::io::base::array::stringize(sparse.dtype);
+    throw std::runtime_error(m.str());
+  }
+
+  //matio writes from our indices and values, without copying them
+  typedef decltype(mat_sparse_t().ir) index_ptr;
+  mat_sparse_t mio_sparse;
+  mio_sparse.nzmax = sparse.nnz;
+  mio_sparse.ir = reinterpret_cast<index_ptr>(const_cast<int32_t*>(sparse.indices.get()));
+  mio_sparse.nir = sparse.nnz;
+  mio_sparse.jc = reinterpret_cast<index_ptr>(const_cast<int32_t*>(sparse.indptr.get()));
+  mio_sparse.njc = sparse.cols + 1;
+  mio_sparse.ndata = sparse.nnz;
+  mio_sparse.data = const_cast<void*>(sparse.data.get());
+
+  int flags = MAT_F_DONT_COPY_DATA;
+  std::vector<double> values;
+  mat_complex_split_t mio_complex;
+  if (sparse.dtype == bob::io::base::array::t_complex128) {
+    //matio wants complex values split
+    values.resize(2*sparse.nnz);
+    mio_complex.Re = values.data();
+    mio_complex.Im = values.data() + sparse.nnz;
+    row_to_col_order_complex(sparse.data.get(), mio_complex.Re, mio_complex.Im,
+        sizeof(double), 1, &sparse.nnz, options.threads);
+    mio_sparse.data = &mio_complex;
+    flags |= MAT_F_COMPLEX;
+  }
+
+  size_t dims[2] = {sparse.rows, sparse.cols};
+  boost::shared_ptr<matvar_t> matvar(Mat_VarCreate(varname, MAT_C_SPARSE,
+        MAT_T_DOUBLE, 2, dims, &mio_sparse, flags), sparse_deleter());
+  if (!matvar) {
+    boost::format m("cannot create sparse matrix `%s'");
+    m % varname;
+    throw std::runtime_error(m.str());
+  }
+
+  int status = Mat_VarWrite(file.get(), matvar.get(),
+      options.compress ? MAT_COMPRESSION_ZLIB : MAT_COMPRESSION_NONE);
+  if (status != 0) {
+    boost::format m("error while writing sparse matrix `%s' to matlab file");
+    m % varname;
+    throw std::runtime_error(m.str());
+  }
+# endif
+
+}
+
+/**
+ * Decodes UTF-8 text into UTF-16 code units, as Matlab(R) stores them.
+ * Characters outside of the basic multilingual plane take two code units, a
+ * surrogate pair, and so two elements of the char array. Returns false if the
+ * text is not valid UTF-8.
+ */
+static bool decode_utf8(const uint8_t* bytes, size_t size,
+    std::vector<uint16_t>& units) {
+
+  units.clear();
+  units.reserve(size);
+  for (size_t k=0; k<size;) {
+    uint32_t c = bytes[k];
+    size_t extra = 0;
+    uint32_t min = 0;
+    if (c < 0x80) { }
+    else if ((c & 0xe0) == 0xc0) { c &= 0x1f; extra = 1; min = 0x80; }
+    else if ((c & 0xf0) == 0xe0) { c &= 0x0f; extra = 2; min = 0x800; }
+    else if ((c & 0xf8) == 0xf0) { c &= 0x07; extra = 3; min = 0x10000; }
+    else return false;
+    if (extra > size - k - 1) return false; ///< truncated
+    for (size_t i=1; i<=extra; ++i) {
+      if ((bytes[k+i] & 0xc0) != 0x80) return false;
+      c = (c << 6) | (bytes[k+i] & 0x3f);
+    }
+    if (c < min || (c >= 0xd800 && c < 0xe000) || c > 0x10ffff) return false;
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      units.push_back(0xd800 + (c >> 10));
+      units.push_back(0xdc00 + (c & 0x3ff));
+    }
+    else units.push_back(c);
+    k += extra + 1;
+  }
+  return true;
+
+}
+
+void read_char(boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, std::vector<uint16_t>& text,
+    size_t& rows, size_t& cols, size_t threads) {
+
+  if (header->class_type != MAT_C_CHAR || header->rank != 2) {
+    boost::format m("object `%s' is not a char array of 2 dimensions");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+  boost::shared_ptr<matvar_t> matvar = make_matvar(file, header->name);
+  if (!matvar) {
+    boost::format m("cannot read char array `%s'");
+    m % header->name;
+    throw std::runtime_error(m.str());
+  }
+
+  rows = matvar->dims[0];
+  cols = matvar->dims[1];
+  text.resize(rows * cols);
+  if (text.empty()) return;
+
+  //each row of characters becomes contiguous
+  mat_type type;
+  type.shape.push_back(rows);
+  type.shape.push_back(cols);
+  switch (matvar->data_type) {
+    case MAT_T_UINT16:
+    case MAT_T_UTF16:
+    case MAT_T_INT16:
+      type.dtype = bob::io::base::array::t_uint16;
+      from_col_order(matvar->data, &text[0], type, threads, false);
+      break;
+    case MAT_T_UTF8:
+      {
+        //characters take a variable number of bytes, so they are decoded
+        //before being re-ordered
+        std::vector<uint16_t> units;
+        if (!decode_utf8(static_cast<const uint8_t*>(matvar->data),
+              matvar->nbytes, units) || units.size() != text.size()) {
+          boost::format m("char array `%s' is not valid UTF-8 text of %u UTF-16 code units");
+          m % header->name % text.size();
+          throw std::runtime_error(m.str());
+        }
+        type.dtype = bob::io::base::array::t_uint16;
+        from_col_order(&units[0], &text[0], type, threads, false);
+      }
+      break;
+    case MAT_T_UINT8:
+    case MAT_T_INT8:
+      {
+        type.dtype = bob::io::base::array::t_uint8;
+        std::vector<uint8_t> bytes(text.size());
+        from_col_order(matvar->data, &bytes[0], type, threads, false);
+        std::copy(bytes.begin(), bytes.end(), text.begin());
+      }
+      break;
+    default:
+      {
+        boost::format m("unsupported encoding for char array `%s'");
+        m % header->name;
+        throw std::runtime_error(m.str());
+      }
+  }
+
+}
+
+void write_char(boost::shared_ptr<mat_t> file, const char* varname,
+    const std::vector<uint16_t>& text, size_t rows, size_t cols,
+    const mat_options& options) {
+
+  if (text.size() != rows * cols) {
+    boost::format m("char array `%s' should have %u characters, not %u");
+    m % varname % (rows * cols) % text.size();
+    throw std::runtime_error(m.str());
+  }
+
+  //Matlab(R) stores characters column after column, as any other array
+  std::vector<uint16_t> data(text.size());
+  if (!data.empty()) {
+    size_t shape[2] = {rows, cols};
+    row_to_col_order(&text[0], &data[0], sizeof(uint16_t), 2, shape,
+        options.threads);
+  }
+
+# if MATIO_1_3_OR_OLDER == 1
+  int dims[2] = {(int)rows, (int)cols};
+# else
+  size_t dims[2] = {rows, cols};
+# endif
+  boost::shared_ptr<matvar_t> matvar(Mat_VarCreate(varname, MAT_C_CHAR,
+        MAT_T_UINT16, 2, dims, data.empty() ? 0 : &data[0],
+        MAT_F_DONT_COPY_DATA), matvar_deleter());
+  if (!matvar) {
+    boost::format m("cannot create char array `%s'");
+    m % varname;
+    throw std::runtime_error(m.str());
+  }
+
+  int status = Mat_VarWrite(file.get(), matvar.get(),
+      options.compress ? MAT_COMPRESSION_ZLIB : MAT_COMPRESSION_NONE);
+  if (status != 0) {
+    boost::format m("error while writing char array `%s' to matlab file");
+    m % varname;
+    throw std::runtime_error(m.str());
+  }
+
+}
+
+mat_archive::mat_archive(const char* path):
+  m_path(path),
+  m_mutex(boost::make_shared<std::mutex>())
+{
+  m_file = make_matfile(path, MAT_ACC_RDONLY);
+  if (!m_file) {
+    boost::format m("cannot open matlab file at '%s'");
+    m % path;
+    throw std::runtime_error(m.str());
+  }
+  std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(m_file.get()));
+
+  boost::shared_ptr<mat_varmap> variables = list_variables(m_file);
+  for (mat_varmap::iterator it = variables->begin(); it != variables->end(); ++it) {
+    m_names.push_back(it->second.name);
+    m_headers[it->second.name] = it->second.header;
+  }
+}
+
+boost::shared_ptr<matvar_t> mat_archive::header(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(*m_mutex);
+  std::map<std::string, boost::shared_ptr<matvar_t> >::const_iterator it =
+    m_headers.find(name);
+  if (it == m_headers.end()) return boost::shared_ptr<matvar_t>();
+  return it->second;
+}
+
+boost::shared_ptr<mat_t> mat_archive::file() const {
+  std::lock_guard<std::mutex> lock(*m_mutex);
+  return m_file;
+}
+
+bool mat_archive::closed() const {
+  std::lock_guard<std::mutex> lock(*m_mutex);
+  return !m_file;
+}
+
+boost::shared_ptr<matvar_t> mat_archive::find(const std::string& name) const {
+  if (!m_file) {
+    boost::format m("matlab file `%s' was closed");
+    m % m_path;
+    throw std::runtime_error(m.str());
+  }
+  std::map<std::string, boost::shared_ptr<matvar_t> >::const_iterator it =
+    m_headers.find(name);
+  if (it == m_headers.end()) {
+    boost::format m("cannot locate variable `%s' in file '%s'");
+    m % name % m_path;
+    throw std::runtime_error(m.str());
+  }
+  return it->second;
+}
+
+void mat_archive::read(const std::string& name, const mat_type& type,
+    void* dst, size_t threads) {
+  std::lock_guard<std::mutex> lock(*m_mutex);
+  boost::shared_ptr<matvar_t> var = find(name);
+  std::unique_lock<std::recursive_mutex> hdf5(hdf5_mutex(), std::defer_lock);
+  if (is_mat73(m_file.get())) hdf5.lock();
+  read_array(m_file, var, type, dst, threads);
+}
+
+void mat_archive::read(const std::string& name, mat_sparse& sparse) {
+  std::lock_guard<std::mutex> lock(*m_mutex);
+  boost::shared_ptr<matvar_t> var = find(name);
+  std::unique_lock<std::recursive_mutex> hdf5(hdf5_mutex(), std::defer_lock);
+  if (is_mat73(m_file.get())) hdf5.lock();
+  read_sparse(m_file, var, sparse);
+}
+
+void mat_archive::read(const std::string& name, std::vector<uint16_t>& text,
+    size_t& rows, size_t& cols, size_t threads) {
+  std::lock_guard<std::mutex> lock(*m_mutex);
+  boost::shared_ptr<matvar_t> var = find(name);
+  std::unique_lock<std::recursive_mutex> hdf5(hdf5_mutex(), std::defer_lock);
+  if (is_mat73(m_file.get())) hdf5.lock();
+  read_char(m_file, var, text, rows, cols, threads);
+}
+
+void mat_archive::close() {
+  std::lock_guard<std::mutex> lock(*m_mutex);
+  //headers are bound to the file they were read from
+  m_headers.clear();
+  m_file.reset();
+}
+
+void mat_peek(boost::shared_ptr<const matvar_t> header,
+    bob::io::base::array::typeinfo& info) {
+  get_var_info(header, info);
+}
+
+void mat_peek(boost::shared_ptr<const matvar_t> header, mat_type& type) {
+  get_var_type(header, type);
+}
+
+void mat_peek(const char* filename, bob::io::base::array::typeinfo& info, const char* varname) {
+
+  boost::shared_ptr<mat_t> mat = make_matfile(filename, MAT_ACC_RDONLY);
+  if (!mat) {
+    boost::format m("cannot open file `%s'");
+    m % filename;
+    throw std::runtime_error(m.str());
+  }
+  std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(mat.get()));
+  boost::shared_ptr<matvar_t> matvar = read_header(mat, varname); //gets the given variable name
+  if (!matvar) {
+    if (varname){
+      boost::format m("Cannot locate variable `%s' in file '%s'");
+      m % varname % filename;
+      throw std::runtime_error(m.str());
+    }else{
+      boost::format m("Cannot find any variable in file '%s'");
+      m % filename;
+      throw std::runtime_error(m.str());
+    }
+  }
+  get_var_info(matvar, info);
+
+}
+
+void mat_peek_set(const char* filename, bob::io::base::array::typeinfo& info, const char* varname) {
+  boost::shared_ptr<mat_t> mat = make_matfile(filename, MAT_ACC_RDONLY);
+  if (!mat) {
+    boost::format m("cannot open file `%s'");
+    m % filename;
+    throw std::runtime_error(m.str());
+  }
+  std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(mat.get()));
+  boost::shared_ptr<matvar_t> matvar = read_header(mat, varname); //gets the first var.
+  if (!matvar) {
+    if (varname){
+      boost::format m("Cannot locate variable `%s' in file '%s'");
+      m % varname % filename;
+      throw std::runtime_error(m.str());
+    }else{
+      boost::format m("Cannot find any variable in file '%s'");
+      m % filename;
+      throw std::runtime_error(m.str());
+    }
+  }
+  get_var_info(matvar, info);
+}
+
+boost::shared_ptr<mat_varmap> list_variables(const char* filename) {
+
+  boost::shared_ptr<mat_t> mat = make_matfile(filename, MAT_ACC_RDONLY);
+  if (!mat) {
+    boost::format m("cannot open file `%s'");
+    m % filename;
+    throw std::runtime_error(m.str());
+  }
+  std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(mat.get()));
+
+  return list_variables(mat);
+}
+
+boost::shared_ptr<mat_varmap> list_variables(boost::shared_ptr<mat_t> mat) {
+
+  boost::shared_ptr<mat_varmap> retval(new mat_varmap());
+
+  Mat_Rewind(mat.get());
+
+  //we only read the variable headers, which is enough to type and shape each
+  //of them without loading (and decompressing) any data
+  size_t id = 0;
+  boost::shared_ptr<matvar_t> matvar;
+  while ((matvar = make_matvar_info(mat))) {
+    mat_variable& var = (*retval)[id++];
+    var.name = matvar->name;
+    get_var_info(matvar, var.type);
+    var.header = matvar;
+  }
+
+  return retval;
+}
+
+array_buffer::array_buffer():
+  m_type(),
+  m_data(),
+  m_ptr(0) {
+}
+
+array_buffer::array_buffer(void* ptr,
+    const bob::io::base::array::typeinfo& info):
+  m_type(info),
+  m_data(),
+  m_ptr(ptr) {
+}
+
+array_buffer::~array_buffer() { }
+
+void array_buffer::set(const bob::io::base::array::interface& other) {
+  set(other.type());
+  std::memcpy(m_ptr, other.ptr(), m_type.buffer_size());
+}
+
+void array_buffer::set(boost::shared_ptr<bob::io::base::array::interface> other) {
+
+  if (m_ptr && !m_data) { ///< external memory, cannot refer to another
+    set(*other);
+    return;
+  }
+
+  m_data = other->owner();
+  m_ptr = other->ptr();
+  m_type = other->type();
+
+}
+
+void array_buffer::set(const bob::io::base::array::typeinfo& req) {
+
+  if (m_type.is_compatible(req)) return; ///< nothing to do
+
+  if (m_ptr && !m_data) {
+    boost::format m("cannot store an array of type `%s' in a buffer of type `%s'");
+    m % req.str() % m_type.str();
+    throw std::runtime_error(m.str());
+  }
+
+  m_data.reset(new char[req.buffer_size()],
+      boost::checked_array_deleter<char>());
+  m_ptr = m_data.get();
+  m_type = req;
+
+}
+
+/**
+ * Reads the variable of a single request
+ */
+static void read_request(const mat_request& request,
+    bob::io::base::array::interface& buf) {
+
+  boost::shared_ptr<mat_t> mat = make_matfile(request.path.c_str(),
+      MAT_ACC_RDONLY);
+  if (!mat) {
+    boost::format m("cannot open file `%s'");
+    m % request.path;
+    throw std::runtime_error(m.str());
+  }
+  std::unique_lock<std::recursive_mutex> hdf5 = lock_hdf5(is_mat73(mat.get()));
+
+  boost::shared_ptr<matvar_t> header = read_header(mat, request.varname.c_str());
+  if (!header) {
+    boost::format m("cannot find variable `%s' in file `%s'");
+    m % request.varname % request.path;
+    throw std::runtime_error(m.str());
+  }
+
+  read_array(mat, header, buf);
+
+}
+
+void read_many(const std::vector<mat_request>& requests,
+    std::vector<boost::shared_ptr<bob::io::base::array::interface> >& bufs,
+    std::vector<std::string>& errors, size_t threads) {
+
+  errors.assign(requests.size(), std::string());
+
+  //each thread picks the next request to serve until there are none left
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t k = next++; k < requests.size(); k = next++) {
+      try {
+        read_request(requests[k], *bufs[k]);
+      }
+      catch (std::exception& e) {
+        errors[k] = e.what();
+      }
+      catch (...) {
+        boost::format m("unknown error while reading variable `%s' from file `%s'");
+        m % requests[k].varname % requests[k].path;
+        errors[k] = m.str();
+      }
+    }
+  };
+
+  threads = std::max<size_t>(1, std::min(threads, requests.size()));
+
+  //the calling thread is one of the workers; if we cannot start as many
+  //threads as requested, the others take up the work. The pool is joined
+  //whatever happens to the calling thread.
+  thread_group pool;
+  for (size_t t=1; t<threads; ++t) if (!pool.start(worker)) break;
+  worker();
+  pool.join();
 
-  return retval;
 }
@@ -12,23 +12,129 @@
 
 #include <map>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
 #include <boost/shared_ptr.hpp>
 #include <matio.h>
 
 #include <bob.io.base/array.h>
 
+/**
+ * Describes one variable found while scanning a .mat file: its name, the
+ * equivalent bob type and the header matio returned for it. The header
+ * records where the variable data starts on the file, so it can be used to
+ * read the data back without searching for the variable again. It is only
+ * valid for as long as the mat_t it was read from remains open.
+ */
+struct mat_variable {
+  std::string name;
+  bob::io::base::array::typeinfo type;
+  boost::shared_ptr<matvar_t> header;
+};
+
+/**
+ * All variables in a file, indexed by their order of appearance
+ */
+typedef std::map<size_t, mat_variable> mat_varmap;
+
+/**
+ * The type of an array, as a typeinfo, but with any number of dimensions.
+ * typeinfo (and therefore the bob.io.base codec) is limited to BOB_MAX_DIM
+ * dimensions, while matio is not.
+ */
+struct mat_type {
+
+  mat_type();
+  mat_type(const bob::io::base::array::typeinfo& info);
+
+  size_t size() const; ///< number of elements
+  size_t item_size() const; ///< size of each element, in bytes
+  size_t buffer_size() const { return size() * item_size(); }
+
+  bob::io::base::array::ElementType dtype;
+  std::vector<size_t> shape;
+
+};
+
+/**
+ * Options controlling how variables are read from and written to .mat files
+ */
+struct mat_options {
+
+  mat_options();
+
+  bool compress; ///< compress variables with zlib (not available for v4 files)
+  int version; ///< format of new files (one of MAT_FT_*), 0 for matio's default
+  size_t chunk; ///< v7.3 only: if set, write arrays in HDF5 chunks of so many rows
+  size_t threads; ///< threads used to re-order large arrays in memory (1 disables threading)
+
+};
+
+/**
+ * Returns the options used for files opened through the bob.io.base codec.
+ * Changing the returned object affects all files opened afterwards.
+ */
+mat_options& default_options();
+
+/**
+ * Tells if the file at path is a v7.3 (HDF5-based) matlab file, by peeking
+ * at the version field of its header, without going through matio
+ */
+bool is_mat73(const char* path);
+
+/**
+ * Same as above, for a file which is already open, asking matio
+ */
+bool is_mat73(mat_t* file);
+
+/**
+ * The HDF5 library used by matio for v7.3 files is not thread-safe by
+ * default, and the functions here may run without holding the Python GIL.
+ * Any access to a v7.3 file must therefore hold the returned lock, which
+ * locks a global (recursive) mutex if the file at path is a v7.3 file, or
+ * is going to be created as one according to version. Files and variables
+ * are closed and freed under the same lock automatically.
+ */
+std::unique_lock<std::recursive_mutex> lock_hdf5(const char* path,
+    int version=0);
+
+/**
+ * Same as above, for callers that already know whether the file is a v7.3
+ * file, so it does not have to be looked up on disk again
+ */
+std::unique_lock<std::recursive_mutex> lock_hdf5(bool mat73);
+
 /**
  * This method will create a new boost::shared_ptr to mat_t that knows how to
- * delete itself
+ * delete itself. If the file has to be created, it uses the given format
+ * version (one of MAT_FT_*), or matio's default if that is zero. The file is
+ * opened under lock_hdf5(filename, version); later accesses to it should be
+ * locked with lock_hdf5(is_mat73(file)) instead.
  */
-boost::shared_ptr<mat_t> make_matfile(const char* filename, int flags);
+boost::shared_ptr<mat_t> make_matfile(const char* filename, int flags,
+    int version=0);
 
 /**
- * Retrieves information about the first variable found on a file.
+ * Retrieves information about the first variable found on a file. Only the
+ * variable header is read.
  */
 void mat_peek(const char* filename, bob::io::base::array::typeinfo& info,
     const char* varname=0);
 
+/**
+ * Retrieves information about a variable from its (already read) header.
+ * Variables with more than BOB_MAX_DIM dimensions are reported with an
+ * unknown type.
+ */
+void mat_peek(boost::shared_ptr<const matvar_t> header,
+    bob::io::base::array::typeinfo& info);
+
+/**
+ * Same as above, for variables of any number of dimensions
+ */
+void mat_peek(boost::shared_ptr<const matvar_t> header, mat_type& type);
+
 /**
  * Retrieves information about the first variable with a certain name
  * (array_%d) that exists in a .mat file (if it exists)
@@ -40,21 +146,512 @@ void mat_peek_set(const char* filename, bob::io::base::array::typeinfo& info,
  * Retrieves information about all variables with a certain name (array_%d)
  * that exist in a .mat file
  */
-boost::shared_ptr<std::map<size_t, std::pair<std::string,
-  bob::io::base::array::typeinfo> > > list_variables(const char* filename);
+boost::shared_ptr<mat_varmap> list_variables(const char* filename);
+
+/**
+ * Same as above, but works on an (already opened) mat_t file. The file is
+ * rewound before the variables are listed. The variable headers are kept on
+ * the returned map and stay valid while the file is open.
+ */
+boost::shared_ptr<mat_varmap> list_variables(boost::shared_ptr<mat_t> file);
+
+/**
+ * Reads the header of the variable with the given name on the (already
+ * opened) mat_t file, without loading its data. If you don't specify the
+ * variable name, I'll just read the next header. Returns an empty pointer if
+ * the variable cannot be found.
+ */
+boost::shared_ptr<matvar_t> read_header(boost::shared_ptr<mat_t> file,
+    const char* varname=0);
 
 /**
  * Reads a variable on the (already opened) mat_t file. If you don't
  * specify the variable name, I'll just read the next one. Re-allocates the
- * buffer if required.
+ * buffer if required. The data is re-ordered using up to the given number of
+ * threads. If col_major is set, the data is copied into buf in column-major
+ * (Fortran) order, as it is on the file, and not re-ordered at all.
  */
 void read_array (boost::shared_ptr<mat_t> file,
-    bob::io::base::array::interface& buf, const char* varname=0);
+    bob::io::base::array::interface& buf, const char* varname=0,
+    size_t threads=1, bool col_major=false);
+
+/**
+ * Reads the data of a variable whose header was already read from the
+ * (still opened) mat_t file. This seeks directly to the variable data
+ * instead of searching the file for it. Re-allocates the buffer if required.
+ */
+void read_array (boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, bob::io::base::array::interface& buf,
+    size_t threads=1, bool col_major=false);
+
+/**
+ * Same as above, for variables of any number of dimensions. The data is
+ * written to dst, which should be large enough for the given type, as
+ * returned by mat_peek().
+ */
+void read_array (boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, const mat_type& type, void* dst,
+    size_t threads=1, bool col_major=false);
+
+/**
+ * Reads part of a variable whose header was already read from the (still
+ * opened) mat_t file. start, stride and count have one entry per dimension of
+ * the variable, following the order of its shape, and describe which elements
+ * to read on each dimension. Only the requested region is decoded. The buffer
+ * is re-allocated to the shape given by count, if required. matio addresses
+ * slices with int values, so this throws if any of them exceeds INT_MAX.
+ */
+void read_slice (boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, const size_t* start,
+    const size_t* stride, const size_t* count,
+    bob::io::base::array::interface& buf);
+
+/**
+ * Reads a variable by blocks of rows (i.e. along its first dimension), so
+ * that only one block has to be kept in memory at a time. This works from
+ * the variable header, so the file must remain open while reading.
+ */
+class mat_block_reader {
+
+  public: //api
+
+    /**
+     * Prepares to read the variable described by header, rows at a time
+     */
+    mat_block_reader(boost::shared_ptr<mat_t> file,
+        boost::shared_ptr<matvar_t> header, size_t rows, size_t threads=1);
+
+    /**
+     * The type of the whole variable
+     */
+    const bob::io::base::array::typeinfo& type() const { return m_type; }
+
+    /**
+     * The total number of blocks in the variable
+     */
+    size_t size() const;
+
+    /**
+     * Reads the next block into the given buffer, re-allocating it if
+     * required, and returns true, or returns false if all blocks were
+     * already read. Finding the type of the block and reading it is a single
+     * operation, so many threads may share the reader. The last block may be
+     * shorter than the others. This takes the HDF5 lock by itself, see
+     * lock_hdf5().
+     *
+     * matio inflates compressed variables from their start for every slice.
+     * Compressed variables of up to MAX_INFLATED_BYTES are therefore
+     * inflated once, on the first block, and kept in memory until the last
+     * one. Larger ones are read block by block, with bounded memory but
+     * a time that grows with the square of the number of blocks.
+     */
+    bool read(bob::io::base::array::interface& buf);
+
+    static const size_t MAX_INFLATED_BYTES;
+
+  private: //api
+
+    /**
+     * Tells if all blocks were already read
+     */
+    bool done() const { return m_row >= m_type.shape[0]; }
+
+    /**
+     * The type of the next block to be read
+     */
+    void next_type(bob::io::base::array::typeinfo& info) const;
+
+  private: //representation
+
+    boost::shared_ptr<mat_t> m_file;
+    boost::shared_ptr<matvar_t> m_header;
+    bob::io::base::array::typeinfo m_type;
+    size_t m_rows;
+    size_t m_row; ///< first row of the next block
+    size_t m_threads; ///< to re-order blocks read from m_whole
+    boost::shared_ptr<matvar_t> m_whole; ///< inflated compressed variable, as read by matio
+    std::mutex m_mutex; ///< serializes reads, which may happen without the GIL
+
+};
 
 /**
- * Appends a single Array into the given matlab file and with a given name
+ * Reads the fields of a struct variable one at a time, so that only the
+ * fields asked for are decoded. This works from the variable header, so the
+ * file must remain open while reading. Elements of struct arrays are
+ * indexed in column-major order, as in matio.
+ */
+class mat_struct_reader {
+
+  public: //api
+
+    /**
+     * Prepares to read the struct variable described by header. Reads are
+     * serialized with mutex, which should be shared with anything else
+     * reading from the same file handle. A new mutex is used if it is empty.
+     */
+    mat_struct_reader(boost::shared_ptr<mat_t> file,
+        boost::shared_ptr<matvar_t> header,
+        boost::shared_ptr<std::mutex> mutex=boost::shared_ptr<std::mutex>());
+
+    /**
+     * The names of the fields of the struct
+     */
+    const std::vector<std::string>& fields() const { return m_fields; }
+
+    /**
+     * The shape of the struct array
+     */
+    const std::vector<size_t>& shape() const { return m_shape; }
+
+    /**
+     * The number of elements in the struct array
+     */
+    size_t size() const;
+
+    /**
+     * The type of the value of a field for the element at index. The type is
+     * unknown if the value is not a numeric array.
+     */
+    void type(const std::string& field, size_t index, mat_type& type) const;
+
+    /**
+     * Reads the value of a field for the element at index, of the given
+     * type, into dst. This takes the HDF5 lock by itself, see lock_hdf5().
+     */
+    void read(const std::string& field, size_t index, const mat_type& type,
+        void* dst, bool col_major=false);
+
+  private: //representation
+
+    boost::shared_ptr<mat_t> m_file;
+    boost::shared_ptr<matvar_t> m_header;
+    boost::shared_ptr<matvar_t> m_whole; ///< the whole struct, once read
+    std::vector<std::string> m_fields;
+    std::vector<size_t> m_shape;
+    bool m_lazy; ///< if fields can be read from their headers
+    boost::shared_ptr<std::mutex> m_mutex; ///< serializes reads, which may happen without the GIL
+
+};
+
+/**
+ * Reads the elements of a cell array one at a time, as they are asked for.
+ * As for structs, this works from the variable header, which lists the
+ * type and shape of every element, so the file must remain open while
+ * reading. Elements are indexed in column-major order, as in matio, and
+ * may be cell arrays themselves.
+ */
+class mat_cell_reader {
+
+  public: //api
+
+    /**
+     * Prepares to read the cell array variable described by header. Reads
+     * are serialized with mutex, as for structs.
+     */
+    mat_cell_reader(boost::shared_ptr<mat_t> file,
+        boost::shared_ptr<matvar_t> header,
+        boost::shared_ptr<std::mutex> mutex=boost::shared_ptr<std::mutex>());
+
+    /**
+     * The shape of the cell array
+     */
+    const std::vector<size_t>& shape() const { return m_shape; }
+
+    /**
+     * The number of elements in the cell array
+     */
+    size_t size() const;
+
+    /**
+     * Tells if the element at index is a cell array itself
+     */
+    bool is_cell(size_t index) const;
+
+    /**
+     * Returns a reader for the cell array at index, which shares the file
+     * (and anything read from it) with this reader
+     */
+    boost::shared_ptr<mat_cell_reader> cell(size_t index) const;
+
+    /**
+     * The type of the element at index. The type is unknown if the element
+     * is not a numeric array.
+     */
+    void type(size_t index, mat_type& type) const;
+
+    /**
+     * Reads the element at index, of the given type, into dst. This takes
+     * the HDF5 lock by itself, see lock_hdf5().
+     */
+    void read(size_t index, const mat_type& type, void* dst,
+        bool col_major=false);
+
+  private: //representation
+
+    /**
+     * Everything read from the file, shared by nested cell arrays
+     */
+    struct whole_variable {
+      boost::shared_ptr<matvar_t> matvar;
+      boost::shared_ptr<std::mutex> mutex; ///< serializes reads, which may happen without the GIL
+    };
+
+    mat_cell_reader(const mat_cell_reader& parent, size_t index);
+
+    /**
+     * The element at index of this cell array, found in the variable root,
+     * which is either the header or the whole variable
+     */
+    matvar_t* element(matvar_t* root, size_t index) const;
+
+    boost::shared_ptr<mat_t> m_file;
+    boost::shared_ptr<matvar_t> m_header; ///< of the top-level cell array
+    std::vector<size_t> m_path; ///< indexes of nested cell arrays
+    boost::shared_ptr<whole_variable> m_whole;
+    std::vector<size_t> m_shape;
+    bool m_lazy; ///< if elements can be read from their headers
+
+};
+
+/**
+ * A buffer that does not depend on Python, so it can be filled from any
+ * thread. It either owns its memory, which is (re-)allocated on demand, or
+ * refers to external memory of a fixed type. A buffer owning its memory may
+ * also take over the memory of another buffer instead of copying it, with
+ * set(boost::shared_ptr<interface>).
+ */
+class array_buffer: public bob::io::base::array::interface {
+
+  public: //api
+
+    /**
+     * Builds an empty buffer, that allocates memory when set
+     */
+    array_buffer();
+
+    /**
+     * Builds a buffer refering to external memory of the given type. It
+     * cannot be re-allocated, and the memory should outlive it.
+     */
+    array_buffer(void* ptr, const bob::io::base::array::typeinfo& info);
+
+    virtual ~array_buffer();
+
+    virtual void set(const bob::io::base::array::interface& other);
+
+    /**
+     * Refers to the memory of other, sharing its ownership, or copies it if
+     * this buffer refers to external memory
+     */
+    virtual void set(boost::shared_ptr<bob::io::base::array::interface> other);
+
+    virtual void set(const bob::io::base::array::typeinfo& req);
+
+    virtual const bob::io::base::array::typeinfo& type() const { return m_type; }
+
+    virtual void* ptr() { return m_ptr; }
+    virtual const void* ptr() const { return m_ptr; }
+
+    /**
+     * The memory owned by this buffer, which is empty for external memory
+     */
+    virtual boost::shared_ptr<void> owner() { return m_data; }
+    virtual boost::shared_ptr<const void> owner() const { return m_data; }
+
+  private: //representation
+
+    bob::io::base::array::typeinfo m_type;
+    boost::shared_ptr<void> m_data;
+    void* m_ptr;
+
+};
+
+/**
+ * A variable to read with read_many()
+ */
+struct mat_request {
+  std::string path;
+  std::string varname;
+};
+
+/**
+ * Reads many variables, from one or many files, on a pool of threads. The
+ * variable of each request is read into the buffer with the same index. Each
+ * file is opened separately, so no file handle is shared among threads. If
+ * a request cannot be served, the reason is stored at its index in errors,
+ * which is empty otherwise. v7.3 (HDF5) files are read one at a time, see
+ * lock_hdf5(). This function does not need the Python GIL.
+ */
+void read_many(const std::vector<mat_request>& requests,
+    std::vector<boost::shared_ptr<bob::io::base::array::interface> >& bufs,
+    std::vector<std::string>& errors, size_t threads);
+
+/**
+ * Appends a single Array into the given matlab file and with a given name,
+ * respecting the compression and chunking options. If col_major is set, the
+ * data in buf is in column-major (Fortran) order and is written as it is.
+ */
+void write_array(boost::shared_ptr<mat_t> file, const char* varname,
+    const bob::io::base::array::interface& buf,
+    const mat_options& options=mat_options(), bool col_major=false);
+
+/**
+ * Same as above, for an array of any number of dimensions at ptr. The array
+ * is never chunked.
  */
 void write_array(boost::shared_ptr<mat_t> file, const char* varname,
-    const bob::io::base::array::interface& buf);
+    const mat_type& type, const void* ptr,
+    const mat_options& options=mat_options(), bool col_major=false);
+
+/**
+ * Writes a struct array of the given shape, with a single call to matio.
+ * types and data give the type and the (row-major) data of the value of
+ * each field for each element, field after field: the value of field f for
+ * the element at (column-major) index k is at f * elements + k.
+ */
+void write_struct(boost::shared_ptr<mat_t> file, const char* varname,
+    const std::vector<size_t>& shape, const std::vector<std::string>& fields,
+    const std::vector<mat_type>& types, const std::vector<const void*>& data,
+    const mat_options& options=mat_options());
+
+/**
+ * A sparse matrix in compressed sparse column (CSC) format, as matio stores
+ * it: the row indices and the values of the non-zero elements of column j
+ * are at positions indptr[j] to indptr[j+1] (excluded) of indices and data.
+ */
+struct mat_sparse {
+
+  mat_sparse();
+
+  bob::io::base::array::ElementType dtype; ///< of the values
+  size_t rows;
+  size_t cols;
+  size_t nnz; ///< number of non-zero elements
+  boost::shared_ptr<const int32_t> indices; ///< nnz row indices
+  boost::shared_ptr<const int32_t> indptr; ///< cols+1 offsets
+  boost::shared_ptr<const void> data; ///< nnz values
+
+};
+
+/**
+ * Reads the sparse matrix described by header. The indices and the real
+ * values are those decoded by matio, which are kept alive by the returned
+ * pointers: the matrix is never expanded to its dense form.
+ */
+void read_sparse(boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, mat_sparse& sparse);
+
+/**
+ * Writes a sparse matrix, of double or complex double values. Row indices
+ * should be sorted within each column, as Matlab(R) expects.
+ */
+void write_sparse(boost::shared_ptr<mat_t> file, const char* varname,
+    const mat_sparse& sparse, const mat_options& options=mat_options());
+
+/**
+ * Reads a char array of two dimensions, as the UTF-16 code units of each of
+ * its rows: text is set to rows * cols code units, row after row. Char data
+ * stored with one byte per character is widened to two, and UTF-8 char data
+ * is decoded, into surrogate pairs for characters outside of the basic
+ * multilingual plane.
+ */
+void read_char(boost::shared_ptr<mat_t> file,
+    boost::shared_ptr<matvar_t> header, std::vector<uint16_t>& text,
+    size_t& rows, size_t& cols, size_t threads=1);
+
+/**
+ * Writes a char array of two dimensions from the UTF-16 code units of each
+ * of its rows, given row after row as above
+ */
+void write_char(boost::shared_ptr<mat_t> file, const char* varname,
+    const std::vector<uint16_t>& text, size_t rows, size_t cols,
+    const mat_options& options=mat_options());
+
+/**
+ * A .mat file kept open for reading, with the headers of all of its
+ * variables, which are read once on construction. Variables are then
+ * decoded one at a time, by name, without searching through the file again.
+ * Reads are serialized, as they may happen without the GIL.
+ */
+class mat_archive {
+
+  public: //api
+
+    /**
+     * Opens the file at path and reads the headers of its variables
+     */
+    mat_archive(const char* path);
+
+    /**
+     * The path to the file
+     */
+    const std::string& path() const { return m_path; }
+
+    /**
+     * The names of the variables, in the order they appear on the file
+     */
+    const std::vector<std::string>& names() const { return m_names; }
+
+    /**
+     * The header of the variable with the given name, or an empty pointer if
+     * there is no such variable or the file was closed
+     */
+    boost::shared_ptr<matvar_t> header(const std::string& name) const;
+
+    /**
+     * The open file, to read variables that keep it (e.g. cell arrays), or
+     * an empty pointer if the file was closed
+     */
+    boost::shared_ptr<mat_t> file() const;
+
+    /**
+     * The mutex serializing reads from the file, to be shared with the
+     * struct and cell array readers that use file()
+     */
+    boost::shared_ptr<std::mutex> mutex() const { return m_mutex; }
+
+    /**
+     * Reads a numeric variable, of the given type, into dst
+     */
+    void read(const std::string& name, const mat_type& type, void* dst,
+        size_t threads=1);
+
+    /**
+     * Reads a sparse matrix, see read_sparse()
+     */
+    void read(const std::string& name, mat_sparse& sparse);
+
+    /**
+     * Reads a char array, see read_char()
+     */
+    void read(const std::string& name, std::vector<uint16_t>& text,
+        size_t& rows, size_t& cols, size_t threads=1);
+
+    /**
+     * Releases the headers and closes the file. This may be called from any
+     * thread, so all accesses to the file and headers take the mutex.
+     */
+    void close();
+
+    /**
+     * Tells if the file was closed
+     */
+    bool closed() const;
+
+  private: //representation
+
+    /**
+     * Same as header(), but throws if there is no such variable. The mutex
+     * should be held.
+     */
+    boost::shared_ptr<matvar_t> find(const std::string& name) const;
+
+    std::string m_path;
+    boost::shared_ptr<mat_t> m_file;
+    std::vector<std::string> m_names;
+    std::map<std::string, boost::shared_ptr<matvar_t> > m_headers;
+    boost::shared_ptr<std::mutex> m_mutex; ///< serializes reads, which may happen without the GIL
+
+};
 
 #endif /* BOB_IO_MATLAB_UTILS_H */
@@ -77,6 +77,13 @@ static PyObject* create_module (void) {
   if (PyModule_AddStringConstant(m, "module", BOB_EXT_MODULE_VERSION) < 0) return 0;
   if (PyModule_AddObject(m, "externals", build_version_dictionary()) < 0) return 0;
 
+  /* matio reads and writes v7.3 files only if it was compiled with HDF5 */
+# if defined(MAT73) && MAT73
+  if (PyModule_AddObject(m, "mat73", Py_BuildValue("O", Py_True)) < 0) return 0;
+# else
+  if (PyModule_AddObject(m, "mat73", Py_BuildValue("O", Py_False)) < 0) return 0;
+# endif
+
   return Py_BuildValue(ret, m);
 }
 
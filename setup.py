@@ -51,14 +51,21 @@ setup(
       Extension("bob.io.matlab._library",
         [
           "bob/io/matlab/bobskin.cpp",
+          "bob/io/matlab/reorder.cpp",
+          "bob/io/matlab/mapping.cpp",
           "bob/io/matlab/utils.cpp",
           "bob/io/matlab/file.cpp",
+          "bob/io/matlab/blocks.cpp",
+          "bob/io/matlab/cells.cpp",
+          "bob/io/matlab/archive.cpp",
           "bob/io/matlab/main.cpp",
         ],
         packages = packages,
         boost_modules = boost_modules,
         bob_packages = bob_packages,
         version = version,
+        extra_compile_args = ['-pthread'],
+        extra_link_args = ['-pthread'],
       ),
     ],
 
@@ -66,6 +73,12 @@ setup(
       'build_ext': build_ext
     },
 
+    entry_points = {
+      'console_scripts': [
+        'bob_matlab_benchmark.py = bob.io.matlab.script.benchmark:main',
+      ],
+    },
+
     classifiers = [
       'Framework :: Bob',
       'Development Status :: 4 - Beta',